@@ -0,0 +1,11 @@
+#pragma once
+
+// Pin assignments come from a board header, picked at build time with
+// BOARD=<name> (see the Makefile). Each defines the port setup in io_init(),
+// and the macros the rest of the firmware reaches the hardware through.
+
+#ifndef BOARD_HEADER
+#define BOARD_HEADER "boards/mk4.h"
+#endif
+
+#include BOARD_HEADER
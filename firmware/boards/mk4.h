@@ -0,0 +1,50 @@
+#pragma once
+
+// The Mk IV PCB (see hardware/), for any of the ATmega48/88/168/328 in 28-pin packages.
+//
+// Port assignments:
+// PORTB0..3 (output) = Digit anode drivers
+// PORTB4    (output) = colon / apostrophe anodes
+// PORTB5    (output) = Camera shutter output (full-press)
+// PORTB6..7          = 32.768kHz watch crystal
+// PORTC0    (input)  = Encoder clock
+// PORTC1    (input)  = Encoder data
+// PORTC2    (input)  = Start (encoder) key
+// PORTC3    (input)  = Select key
+// PORTC4    (input)  = Set key
+// PORTC5    (output) = Camera shutter output (half-press)
+// PORTD0..7 (output) = Segment cathodes (PD7 = A, PD6 = B, ... PD0 = DP)
+//                      (PD0/PD1 double as the USART in remote mode)
+
+#define BOARD_DDRB  0b00111111
+#define BOARD_PORTB 0b00000000
+#define BOARD_DDRC  0b00100000
+#define BOARD_PORTC 0b00011100      // pull-ups on the keys
+#define BOARD_DDRD  0b11111111
+#define BOARD_PORTD 0b11111111
+
+#define DIGITS_OFF()   PORTB &= 0b11100000;
+#define DIGIT_ON(x)    PORTB |= (1 << x)
+
+#define SHUTTER_OFF()  PORTB &= ~(1 << PB5)
+#define SHUTTER_ON()   PORTB |= (1 << PB5)
+
+#define SHUTTER_HALFPRESS_OFF()  PORTC &= ~(1 << PC5)
+#define SHUTTER_HALFPRESS_ON()   PORTC |= (1 << PC5)
+
+// how many of the two shutter transistors are switched on
+#define SHUTTER_LINES() (((PORTB >> PB5) & 1) + ((PORTC >> PC5) & 1))
+
+#define DIGIT_VALUE(x) PORTD = x
+
+// encoder contacts as [B A], open (1) on a detent
+#define ENCODER_STATE() (PINC & 0b11)
+// keys as [Set Select Start], 0 while pressed
+#define BUTTON_STATE() ((PINC & 0b11100) >> 2)
+
+// the encoder and keys share one pin-change interrupt
+#define INPUT_PCINT_vect     PCINT1_vect
+#define INPUT_PCMSK          PCMSK1
+#define INPUT_PCIE           PCIE1
+#define INPUT_PCMSK_ENCODER  ((1 << PCINT8) | (1 << PCINT9))
+#define INPUT_PCMSK_BUTTONS  ((1 << PCINT10) | (1 << PCINT11) | (1 << PCINT12))
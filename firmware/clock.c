@@ -1,79 +1,219 @@
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
 #include <util/delay.h>
 #include "clock.h"
 #include "display.h"
+#include "sequence.h"
+#include "sensors.h"
+#include "settings.h"
+#include "instrument.h"
 
-volatile int8_t gMin, gSec;
-volatile int8_t gDirection = -1;
+// read only through clock_ticks(): it takes four loads, and the ISR may
+// change it in between
+static volatile uint32_t ticks;
+
+// tenths of a ppm, and the error they've added up to since the last timer
+// count was made up. One count is 1/CLOCK_STEP of a tick
+#define XTAL_COUNT (10000000L / CLOCK_STEP)
+static volatile int16_t correction;
+static int32_t xtal_error;
+
+// the time of day, and the armed start time (RTC_OFF if none), in seconds since
+// midnight; with the compensation's error in whole seconds, as above
+static volatile uint32_t rtc_secs;
+static volatile uint32_t alarm_secs = RTC_OFF;
+static int32_t rtc_error;
+volatile uint8_t rtc_alarm = 0;
+
+uint8_t blink_origin;
 
 void clock_init()
 {
     // Setup the RTC...
-    gMin = 0;
-    gSec = 0;
+    ticks = 0;
 
     // select asynchronous operation of Timer2
     ASSR = (1<<AS2);
 
-    // select prescaler: 32.768 kHz / 128 = 1 sec between each overflow
+    // select prescaler: 32.768 kHz / 128 = 256 ticks per second.
+    // TCNT2 free-runs (wrapping once a second) and OCR2A is stepped along behind it
+    // to interrupt every 1/8 second.
+    // The crystal takes up to a second to start; nothing waits for it here, and
+    // it keeps running through power-save, so only clock_start() ever has to
     TCCR2A = 0;
     TCCR2B = (1<<CS22) | (1<<CS20);
 
-    clock_wait_for_xtal();
+    // ...and the time of day, on the once-a-second overflow
+    TIMSK2 = (1 << TOIE2);
+}
 
-    // clear interrupt-flags
-    TIFR2 = 0xFF;
+uint8_t clock_ready()
+{
+    // the control register writes reach the async domain on crystal edges
+    return !(ASSR & ((1 << TCR2AUB) | (1 << TCR2BUB) | (1 << TCN2UB)));
 }
 
 void clock_wait_for_xtal()
 {
-    // wait for TCN2UB and TCRAUB to be cleared
-    while(ASSR & ((1 << TCR2AUB)|(1 << TCN2UB))) {
+    while (!clock_ready()) {
         display_spin();
         _delay_ms(100);
     }
 }
 
+void clock_snooze(uint8_t counts)
+{
+    // the compare value has to reach the async domain before we sleep, or the
+    // old one could wake us (and the datasheet wants a crystal cycle since the
+    // last wake-up anyway)
+    OCR2B = TCNT2 + counts;
+    while (ASSR & (1 << OCR2BUB));
+    TIFR2 = (1 << OCF2B);
+    TIMSK2 |= (1 << OCIE2B);
+    set_sleep_mode(SLEEP_MODE_PWR_SAVE);
+    sleep_mode();
+    TIMSK2 &= (uint8_t)~(1 << OCIE2B);
+}
+
+// only here to end clock_snooze()
+ISR(TIMER2_COMPB_vect)
+{
+}
+
 void clock_start() {
-    TCNT2 = 0;
-    TIFR2 = (1 << TOV2);
-    TIMSK2 |= (1 << TOIE2);
+    // time the sequence from this moment, to the nearest 1/256 second:
+    // the first compare match is a full step from now.
+    // (don't clear the flag until the new compare value has reached the async domain,
+    // or the old one could still match)
+    ticks = 0;
+    OCR2A = TCNT2 + CLOCK_STEP;
+    while (ASSR & (1 << OCR2AUB));
+    TIFR2 = (1 << OCF2A);
+    TIMSK2 |= (1 << OCIE2A);
 }
 
 void clock_stop() {
-    TIMSK2 &= (uint8_t)~(1 << TOIE2);
+    TIMSK2 &= (uint8_t)~(1 << OCIE2A);
 }
 
-// Timer interrupt service routine
-// Executes once per second, driven by the 32.768khz xtal
+uint32_t clock_ticks()
+{
+    uint8_t sreg = SREG;
+    cli();
+    uint32_t t = ticks;
+    SREG = sreg;
+    return t;
+}
+
+void clock_compensate(int8_t celsius)
+{
+    int16_t c = xtal_trim * 10;
+    if (celsius != TEMP_UNKNOWN) {
+        int16_t d = celsius - 25;
+        // 0.034ppm/C^2 is 34/100 of a tenth
+        c += (34UL * (uint16_t)(d * d) + 50) / 100;
+    }
+    uint8_t sreg = SREG;
+    cli();
+    correction = c;
+    SREG = sreg;
+}
+
+int16_t clock_correction()
+{
+    uint8_t sreg = SREG;
+    cli();
+    int16_t c = correction;
+    SREG = sreg;
+    return c;
+}
 
+uint32_t rtc_now()
+{
+    uint8_t sreg = SREG;
+    cli();
+    uint32_t s = rtc_secs;
+    SREG = sreg;
+    return s;
+}
+
+void rtc_set(uint32_t secs)
+{
+    uint8_t sreg = SREG;
+    cli();
+    rtc_secs = secs;
+    rtc_error = 0;
+    SREG = sreg;
+}
+
+void rtc_arm(uint32_t secs)
+{
+    uint8_t sreg = SREG;
+    cli();
+    alarm_secs = secs;
+    rtc_alarm = 0;
+    SREG = sreg;
+}
+
+uint32_t rtc_armed()
+{
+    uint8_t sreg = SREG;
+    cli();
+    uint32_t s = alarm_secs;
+    SREG = sreg;
+    return s;
+}
+
+// Once a second, as TCNT2 wraps. The compensation adds or drops a second
+// every so often (it takes days at these corrections), rather than moving
+// TCNT2, which the sequencer's compare value is stepped along
 ISR(TIMER2_OVF_vect)
 {
-    if (gDirection > 0) {
-        // counting up...
-        if (++gSec == 60) {
-            gSec = 0;
-            if (++gMin == 100) {
-                gMin = 0;
-            }
-        }
+    INSTR_ENTER();
+    uint8_t n = 1;
+    rtc_error += correction;
+    if (rtc_error >= 10000000L) {
+        rtc_error -= 10000000L;
+        ++n;
+    } else if (rtc_error <= -10000000L) {
+        rtc_error += 10000000L;
+        --n;
     }
-    else if (gDirection < 0) {
-        // counting down...
-        if (gSec == 0) {
-            if (gMin > 0) {
-                gSec = 59;
-                gMin--;
-            } else {
-                // the down-timer started at 0
-                // (we just finished a sub-second delay)
-                gDirection = 0;
-            }
-        } else {
-            if (--gSec == 0 && gMin == 0) {
-                // time has elapsed.
-                gDirection = 0;
-            }
+    while (n--) {
+        uint32_t s = rtc_secs + 1;
+        if (s == RTC_DAY)
+            s = 0;
+        rtc_secs = s;
+        if (s == alarm_secs) {
+            alarm_secs = RTC_OFF;
+            rtc_alarm = 1;
         }
     }
+    INSTR_EXIT(INSTR_RTC);
+}
+
+// Timer interrupt service routine
+// Executes every 1/8 second, driven by the 32.768khz xtal. OCR2A only ever
+// steps forward by whole ticks, give or take the compensation's odd count, so
+// the count keeps to the crystal
+
+ISR(TIMER2_COMPA_vect)
+{
+    INSTR_ENTER();
+    uint8_t step = CLOCK_STEP;
+    xtal_error += correction;
+    if (xtal_error >= XTAL_COUNT) {
+        xtal_error -= XTAL_COUNT;
+        --step;
+    } else if (xtal_error <= -XTAL_COUNT) {
+        xtal_error += XTAL_COUNT;
+        ++step;
+    }
+    OCR2A += step;
+
+    uint32_t t = ticks + 1;
+    ticks = t;
+    if (t == sequence_due)
+        sequence_edge(t);
+    INSTR_EXIT(INSTR_CLOCK);
 }
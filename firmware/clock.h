@@ -2,14 +2,49 @@
 
 // resources used: timer2
 
-extern volatile int8_t gMin, gSec;
-extern volatile int8_t gDirection;
+#define CLOCK_TICKS_PER_SEC 8
+// timer2 ticks (1/256 s) per clock tick
+#define CLOCK_STEP (256 / CLOCK_TICKS_PER_SEC)
 
 void clock_init();
+// count ticks from zero, starting now
 void clock_start();
 void clock_stop();
+// ticks since clock_start(); safe with interrupts on or off
+uint32_t clock_ticks();
+// the crystal has started, so clock_start() won't stall
+uint8_t clock_ready();
+// spin the display until it has
 void clock_wait_for_xtal();
+// power-save sleep for counts/256 s (or until another interrupt)
+void clock_snooze(uint8_t counts);
 
-#define CLOCK_BLINKING() (TCNT2 & 0x80)
-#define CLOCK_BLINK_RESET() TCNT2 = 0
+// Crystal compensation. A tuning-fork crystal runs slow either side of 25C,
+// by about 0.034ppm per degree squared; the ISR makes up for that, and for
+// xtal_trim (settings.h), by now and then stepping a tick one timer count
+// (1/256 s) short or long.
+// set the correction for a die temperature in degrees C (TEMP_UNKNOWN: trim only)
+void clock_compensate(int8_t celsius);
+// the correction in force, in tenths of a ppm; positive = speeding the clock up
+int16_t clock_correction();
 
+// Real-time clock: the time of day in seconds since midnight, counted on
+// timer2's overflow whether or not a sequence is running, and through power-save.
+// It starts from midnight at power-up
+#define RTC_DAY 86400UL
+#define RTC_OFF 0xFFFFFFFFUL
+uint32_t rtc_now();
+void rtc_set(uint32_t secs);
+// start a sequence at secs (RTC_OFF: don't). rtc_alarm goes nonzero when the
+// time comes, and the alarm disarms itself; the reader clears rtc_alarm
+void rtc_arm(uint32_t secs);
+// the armed time, or RTC_OFF
+uint32_t rtc_armed();
+extern volatile uint8_t rtc_alarm;
+
+// half a second on, half off, from the last reset. TCNT2 itself is left
+// alone: the clock and the sequencer both count on it
+extern uint8_t blink_origin;
+#define CLOCK_PHASE() ((uint8_t)(TCNT2 - blink_origin))
+#define CLOCK_BLINKING() (CLOCK_PHASE() & 0x80)
+#define CLOCK_BLINK_RESET() (blink_origin = TCNT2)
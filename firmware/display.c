@@ -9,19 +9,23 @@
 #include "io.h"
 #include "display.h"
 #include "settings.h"
+#include "clock.h"
+#include "instrument.h"
 
 // 0 = on since we're using a common anode display
+#define SEG_0 0b00000011
+#define SEG_1 0b10011111
+#define SEG_2 0b00100101
+#define SEG_3 0b00001101
+#define SEG_4 0b10011001
+#define SEG_5 0b01001001
+#define SEG_6 0b01000001
+#define SEG_7 0b00011111
+#define SEG_8 0b00000001
+#define SEG_9 0b00001001
+
 const uint8_t digits[16] PROGMEM = {
-    0b00000011, // 0
-    0b10011111, // 1
-    0b00100101, // 2
-    0b00001101, // 3
-    0b10011001, // 4
-    0b01001001, // 5
-    0b01000001, // 6
-    0b00011111, // 7
-    0b00000001, // 8
-    0b00001001, // 9
+    SEG_0, SEG_1, SEG_2, SEG_3, SEG_4, SEG_5, SEG_6, SEG_7, SEG_8, SEG_9,
     0b00010001, // A
     0b11000001, // B
     0b01100011, // C
@@ -30,26 +34,64 @@ const uint8_t digits[16] PROGMEM = {
     0b01110001  // F
 };
 
+// both digits of every number 0-99, so drawing one is two table loads
+// instead of a division
+#define TENS(t) { t, SEG_0 }, { t, SEG_1 }, { t, SEG_2 }, { t, SEG_3 }, { t, SEG_4 }, \
+                { t, SEG_5 }, { t, SEG_6 }, { t, SEG_7 }, { t, SEG_8 }, { t, SEG_9 }
+const uint8_t two_digits[100][2] PROGMEM = {
+    TENS(SEG_0), TENS(SEG_1), TENS(SEG_2), TENS(SEG_3), TENS(SEG_4),
+    TENS(SEG_5), TENS(SEG_6), TENS(SEG_7), TENS(SEG_8), TENS(SEG_9)
+};
+
+// timer0 runs at F_CPU/64, or F_CPU/256 from 4MHz up, to keep the refresh
+// periods within its 8 bits
+#if F_CPU >= 4000000UL
+#define T0_PRESCALE 256
+#define T0_CLOCK_SELECT (1<<CS02)
+#else
+#define T0_PRESCALE 64
+#define T0_CLOCK_SELECT ((1<<CS01) | (1<<CS00))
+// and 1/8 while the system clock is slowed by 8
+#define T0_CLOCK_SELECT_SLOW (1<<CS01)
+#endif
+
+// timer0 ticks between one refresh of a digit and the next, for ~96Hz
+#define REFRESH_TICKS (F_CPU / T0_PRESCALE / 96)
+// how long a digit stays lit at full brightness: its whole share of the
+// refresh with all five slots lit, less a tick to blank before the next
+#define ON_TICKS (REFRESH_TICKS / 5 - 2)
+
+_Static_assert(REFRESH_TICKS / 2 - 1 <= 255, "display refresh period doesn't fit timer0");
+_Static_assert(ON_TICKS >= 16, "too few timer0 ticks per digit for the brightness levels");
+
+// on-time for a brightness level; every level keeps at least a tick
+static uint8_t on_ticks(uint8_t shift)
+{
+    uint8_t t = ON_TICKS >> shift;
+    return t ? t : 1;
+}
+
 void display_init()
 {
 #ifdef TEST_DISPLAY
-    for(uint8_t digit = 1; digit != 0b100000; digit <<= 1) {
-        PORTB &= 0b11100000;
-        PORTB |= digit;
+    for(uint8_t digit = 0; digit < 5; ++digit) {
+        DIGITS_OFF();
+        DIGIT_ON(digit);
         for(uint8_t segment = 1; segment != 0; segment <<= 1) {
-            PORTD = ~segment;
+            DIGIT_VALUE(~segment);
             _delay_ms(100);
         }
     }
 #endif
 
     TCCR0A = (1<<WGM01);             // CTC mode
-    TCCR0B = (1<<CS01) | (1<<CS00);  // 1/64 prescaler
+    TCCR0B = T0_CLOCK_SELECT;
 
     // Output compare value A - refreshes a digit.
-    // At 2MHz clock, 1/64 prescaler, timer ticks happen at 31kHz, so reset the timer after 64 ticks
-    // for interrupts at 488Hz and a per-digit refresh rate of 98Hz.
-    OCR0A = 64;
+    // At 2MHz clock, 1/64 prescaler, timer ticks happen at 31kHz, so reset the timer after 65 ticks
+    // for interrupts at 480Hz and a per-digit refresh rate of 96Hz.
+    // (That's with all five slots lit; blank ones are skipped, see below.)
+    OCR0A = REFRESH_TICKS / 5 - 1;
 
     // Note we use a compare-match instead of overflow here because this needs to be
     // a higher priority interrupt than the blanking one; otherwise, if the CPU is busy
@@ -60,13 +102,29 @@ void display_init()
     // Output compare value B - controls blanking.
     // In full brightness mode, we'll make this happen immediately before the refresh,
     // In lower brightness modes, we'll make it happen sooner.
-    OCR0B = 63 >> bright;
+    OCR0B = on_ticks(bright);
 
     // Enable compare match A and B interrupts
     TIMSK0 = (1<<OCIE0A) | (1<<OCIE0B);
 }
 
 volatile uint8_t display[5] = { '\xff', '\xff', '\xff', '\xff', '\xff' };
+uint8_t frame[5] = { '\xff', '\xff', '\xff', '\xff', '\xff' };
+
+// The refresh only visits the slots that have something lit in them.
+// Each lit digit is still drawn once every REFRESH_TICKS (96Hz), with the
+// same on-time, so its duty cycle--and brightness--doesn't depend on how many
+// others are lit; the interrupts for blank slots are simply never taken.
+// A lone digit gets a dark partner slot, since REFRESH_TICKS won't fit in OCR0A.
+#define NO_DIGIT 0xFF
+#define SLOT_PERIOD(n) (REFRESH_TICKS / (n) - 1)
+const uint8_t slot_period[6] PROGMEM = {       // OCR0A by slot count
+    SLOT_PERIOD(2), SLOT_PERIOD(2), SLOT_PERIOD(2), SLOT_PERIOD(3), SLOT_PERIOD(4), SLOT_PERIOD(5)
+};
+
+static volatile uint8_t slots[5] = { 0, 1, 2, 3, 4 };
+static volatile uint8_t slot_count = 5;
+static volatile uint8_t OCR0A_buf = SLOT_PERIOD(5);
 
 // Refresh interrupt - refreshes the next digit on the display.
 // By drawing each in turn quickly enough, we give the illusion of
@@ -74,11 +132,20 @@ volatile uint8_t display[5] = { '\xff', '\xff', '\xff', '\xff', '\xff' };
 // to drive each digit independently.
 ISR(TIMER0_COMPA_vect)
 {
-    static uint8_t didx = 0;
-    DIGIT_VALUE(display[didx]);
-    DIGIT_ON(didx);
-    if (++didx == 5)
-        didx = 0;
+    INSTR_LATE(TCNT0 * T0_PRESCALE);
+    INSTR_ENTER();
+    static uint8_t sidx = 0;
+    if (sidx >= slot_count) {
+        sidx = 0;
+        // the counter has just cleared, so it can't already be past the new top
+        OCR0A = OCR0A_buf;
+    }
+    uint8_t d = slots[sidx++];
+    if (d != NO_DIGIT) {
+        DIGIT_VALUE(display[d]);
+        DIGIT_ON(d);
+    }
+    INSTR_EXIT(INSTR_REFRESH);
 }
 
 volatile uint8_t OCR0B_buf = 0;
@@ -90,6 +157,7 @@ volatile uint8_t OCR0B_buf = 0;
 // brightness of the display.
 ISR(TIMER0_COMPB_vect)
 {
+    INSTR_ENTER();
     DIGITS_OFF();
 
     // buffer updates to OCR0B to prevent glitches while changing brightness
@@ -97,99 +165,151 @@ ISR(TIMER0_COMPB_vect)
         OCR0B = OCR0B_buf;
         OCR0B_buf = 0;
     }
+    INSTR_EXIT(INSTR_BLANK);
 }
 
-void IntToDigs2(int n, uint8_t digs[2])
+// split 0-999 into hundreds and the rest, in four steps whatever the value
+static uint8_t split_hundreds(uint16_t *n)
 {
-    digs[0] = 0;
-    while(n >= 10)
-    {
-        n -= 10;
-        ++digs[0];
-    }
+    uint8_t h = 0;
+    if (*n >= 800) { *n -= 800; h = 8; }
+    if (*n >= 400) { *n -= 400; h += 4; }
+    if (*n >= 200) { *n -= 200; h += 2; }
+    if (*n >= 100) { *n -= 100; h += 1; }
+    return h;
+}
+
+#define DECIMAL_POINT 1
+
+void DisplayAlnum(char letter, uint16_t num, uint8_t blink_mask, uint8_t dp)
+{
+    uint8_t hundreds = split_hundreds(&num);
+    frame[0] = letter ^ ((dp & 8) ? DECIMAL_POINT : 0);
+    frame[1] = (hundreds && !(CLOCK_PHASE() & blink_mask)) ? pgm_read_byte(&digits[hundreds]) : EMPTY;
+    frame[1] ^= (dp & 4) ? DECIMAL_POINT : 0;
+    frame[4] = EMPTY;
+    DisplayNum(num, LOW_POS, blink_mask, (blink_mask == 0 && hundreds == 0) ? 1 : 0, dp);
+}
 
-    digs[1] = 0;
-    while(n >= 1)
-    {
-        n -= 1;
-        ++digs[1];
+void DisplayNum(uint8_t num, uint8_t pos, uint8_t blink_mask, uint8_t strip, uint8_t dp)
+{
+    if (CLOCK_PHASE() & blink_mask) {
+        frame[pos] = EMPTY;
+        frame[pos + 1] = EMPTY;
+        return;
     }
+
+    frame[pos] = ((strip & 1) && (num < 10)) ? EMPTY
+        : pgm_read_byte(&two_digits[num][0]);
+    if (dp & 2) frame[pos] ^= DECIMAL_POINT;
+    frame[pos + 1] = ((strip & 2) && (num == 0)) ? EMPTY
+        : pgm_read_byte(&two_digits[num][1]);
+    if (dp & 1) frame[pos + 1] ^= DECIMAL_POINT;
 }
 
-void IntToDigs3(uint16_t n, uint8_t digs[3])
+void Display3(int16_t num, uint8_t letter, uint8_t dp_pos, uint8_t degree)
 {
-    digs[0] = 0;
-    while(n >= 100)
-    {
-        n -= 100;
-        ++digs[0];
+    uint16_t n;
+    if (num < 0) {
+        n = -num;
+        frame[0] = MINUS_SIGN;
+    } else {
+        n = num;
+        frame[0] = pgm_read_byte(&digits[split_hundreds(&n)]);
     }
+    frame[1] = pgm_read_byte(&two_digits[n][0]);
+    frame[2] = pgm_read_byte(&two_digits[n][1]);
+    if (dp_pos < 3)
+        frame[dp_pos] ^= DECIMAL_POINT;
+    frame[3] = letter;
+    frame[4] = degree ? APOS : EMPTY;
+}
 
-    IntToDigs2(n, &digs[1]);
+void DisplayHex(uint8_t num, uint8_t pos)
+{
+    frame[pos] = pgm_read_byte(&digits[num >> 4]);
+    frame[pos + 1] = pgm_read_byte(&digits[num & 0xF]);
 }
 
-#define DECIMAL_POINT 1
+static uint8_t power_level = DISPLAY_ON;
+static uint8_t t0_clock_select = T0_CLOCK_SELECT;
+static uint8_t lit_segments = 0;    // in display[]
 
-void DisplayAlnum(char letter, uint8_t num, uint8_t blink_mask, uint8_t dp)
+void display_set_brightness(uint8_t bright)
 {
-    display[0] = letter ^ ((dp & 8) ? DECIMAL_POINT : 0);
-    display[1] = EMPTY ^ ((dp & 4) ? DECIMAL_POINT : 0);
-    display[4] = EMPTY;
-    DisplayNum(num, LOW_POS, blink_mask, (blink_mask == 0) ? 1 : 0, dp);
+    if (power_level == DISPLAY_ON)
+        OCR0B_buf = on_ticks(bright);
 }
 
-void DisplayNum(uint8_t num, uint8_t pos, uint8_t blink_mask, uint8_t strip, uint8_t dp)
+void display_set_power(uint8_t level)
 {
-    uint8_t digs[2];
+    if (level == power_level)
+        return;
 
-    if (TCNT2 & blink_mask) {
-        display[pos] = EMPTY;
-        display[pos + 1] = EMPTY;
+    if (level == DISPLAY_OFF) {
+        // stop the refresh altogether; no LED current and no refresh interrupts
+        TCCR0B = 0;
+        DIGITS_OFF();
     } else {
-        IntToDigs2(num, digs);
-        display[pos] = ((strip & 1) && (num < 10)) ? EMPTY
-            : pgm_read_byte(&digits[digs[0]]);
-        if (dp & 2) display[pos] ^= DECIMAL_POINT;
-        display[pos + 1] = ((strip & 2) && (num == 0)) ? EMPTY
-            : pgm_read_byte(&digits[digs[1]]);
-        if (dp & 1) display[pos + 1] ^= DECIMAL_POINT;
+        OCR0B_buf = on_ticks((level == DISPLAY_DIM) ? 5 : bright);
+        if (power_level == DISPLAY_OFF)
+            TCCR0B = t0_clock_select;
     }
+    power_level = level;
 }
 
-void Display3(int16_t num, uint8_t letter, uint8_t dp_pos, uint8_t degree)
+#ifdef SYSCLK_SLOW
+void display_retime(uint8_t slow)
 {
-    uint8_t digs[3];
-    if (num < 0) {
-        IntToDigs2(-num, &digs[0]);
-        display[0] = MINUS_SIGN;
-        display[1] = pgm_read_byte(&digits[digs[0]]) ^ ((dp_pos == 0) ? DECIMAL_POINT : 0);
-        display[2] = pgm_read_byte(&digits[digs[1]]) ^ ((dp_pos == 1) ? DECIMAL_POINT : 0);
-    } else {
-        IntToDigs3(num, &digs[0]);
-        for(uint8_t p = 0; p < 3; ++p) {
-            display[p] = pgm_read_byte(&digits[digs[p]]) ^ ((dp_pos == p) ? DECIMAL_POINT : 0);
-        }
-    }
-    display[3] = letter;
-    display[4] = degree ? APOS : EMPTY;
+    _Static_assert(SYSCLK_SLOW == 8 && T0_PRESCALE == 64, "no timer0 prescaler to match the slowed clock");
+    t0_clock_select = slow ? T0_CLOCK_SELECT_SLOW : T0_CLOCK_SELECT;
+    // OCR0A and OCR0B count timer0 ticks, which keep their length
+    if (TCCR0B)
+        TCCR0B = t0_clock_select;
 }
+#endif
 
-void DisplayHex(uint8_t num, uint8_t pos)
+uint8_t display_lit(uint8_t *level)
 {
-    display[pos] = pgm_read_byte(&digits[num >> 4]);
-    display[pos + 1] = pgm_read_byte(&digits[num & 0xF]);
+    *level = (power_level == DISPLAY_DIM) ? 5 : bright;
+    return (power_level == DISPLAY_OFF) ? 0 : lit_segments;
 }
 
-void display_set_brightness(uint8_t bright)
+void display_commit()
 {
-    OCR0B_buf = 63 >> bright;
+    for(uint8_t i = 0; i < 5; ++i) {
+        if (frame[i] != display[i]) {
+            // copy the whole frame with the refresh interrupt held off,
+            // so it never shows half of one frame and half of the next
+            uint8_t n = 0;
+            cli();
+            for(i = 0; i < 5; ++i) {
+                display[i] = frame[i];
+                if (frame[i] != EMPTY)
+                    slots[n++] = i;
+            }
+            while (n < 2)
+                slots[n++] = NO_DIGIT;
+            slot_count = n;
+            OCR0A_buf = pgm_read_byte(&slot_period[n]);
+            sei();
+            // count the segments on (the 0 bits)
+            uint8_t lit = 0;
+            for(i = 0; i < 5; ++i)
+                for (uint8_t v = frame[i]; v != 0xFF; v |= v + 1)
+                    ++lit;
+            lit_segments = lit;
+            return;
+        }
+    }
 }
 
 void display_spin()
 {
     static uint8_t bit = 0b10000000;
-    display[0] = display[1] = display[2] = display[3] = ~bit;
+    frame[0] = frame[1] = frame[2] = frame[3] = ~bit;
     bit >>= 1;
     if (bit == 0b10)
         bit = 0b10000000;
+    display_commit();
 }
@@ -4,7 +4,18 @@
 
 void display_init();
 
-volatile uint8_t display[5];
+// what the refresh ISR shows
+extern volatile uint8_t display[5];
+// the frame being drawn; the Display* functions and direct writes go here,
+// and display_commit() publishes it
+extern uint8_t frame[5];
+
+// publish the frame to the refresh ISR, if it changed
+void display_commit();
+
+// segments lit (none while the display's off), and the brightness level they're
+// lit at, 0-5 as for display_set_brightness(); for the energy accounting
+uint8_t display_lit(uint8_t *level);
 
 #define LETTER_C 0b01100011
 #define LETTER_L 0b11100011
@@ -20,10 +31,13 @@ volatile uint8_t display[5];
 #define LETTER_1 0b10011111
 #define LETTER_T 0b11100001
 #define LETTER_P 0b00110001
+#define LETTER_D 0b10000101
+#define LETTER_R 0b11110101
 #define DECIMAL  0b11111110
 #define MINUS_SIGN 0b11111101
 
-void DisplayAlnum(char letter, uint8_t num, uint8_t blink_mask, uint8_t dp);
+// a letter, then a number (0-999) on the right
+void DisplayAlnum(char letter, uint16_t num, uint8_t blink_mask, uint8_t dp);
 
 #define HIGH_POS 0
 #define LOW_POS  2
@@ -37,6 +51,7 @@ void DisplayAlnum(char letter, uint8_t num, uint8_t blink_mask, uint8_t dp);
 // strip - bit 0 = don't display tens place if num < 10
 //         bit 1 = ...           ones place if num == 0
 // dp = bit 0 = low digit decimal point on; bit 1 = high digit decimal point on
+// num range: 0-99
 void DisplayNum(uint8_t num, uint8_t pos, uint8_t blink_mask, uint8_t strip, uint8_t dp);
 
 // display a three digit number followed by a letter, optionally with decimal point and/or degree sign
@@ -49,5 +64,14 @@ void DisplayHex(uint8_t num, uint8_t pos);
 // valid brightness levels: 0-5
 void display_set_brightness(uint8_t bright);
 
+// display power levels, layered over the brightness setting
+#define DISPLAY_ON   0
+#define DISPLAY_DIM  1  // lowest brightness
+#define DISPLAY_OFF  2  // refresh stopped, LEDs dark
+void display_set_power(uint8_t level);
+
+// keep the refresh rate as the system clock is slowed (or not); see sysclk_slow()
+void display_retime(uint8_t slow);
+
 // indeterminate progress indicator
 void display_spin();
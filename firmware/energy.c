@@ -0,0 +1,166 @@
+#include <string.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "energy.h"
+#include "io.h"
+#include "display.h"
+#include "settings.h"
+#include "clock.h"
+
+#define CYCLES_PER_SEC  20
+#define CYCLES_PER_HOUR (CYCLES_PER_SEC * 3600UL)
+#define TICKS_PER_HOUR  (CLOCK_TICKS_PER_SEC * 3600UL)
+#define NIGHT_TICKS     (ENERGY_NIGHT_HOURS * TICKS_PER_HOUR)
+
+// segments lit through a sequence: a countdown like 12:34
+#define RUN_SEGMENTS 16
+
+// what's counted: cycles awake; cycles times lit segments, at each brightness level
+// (0 = brightest, as on_ticks() shifts); cycles times shutter lines on; ADC bursts;
+// cycles in power-save; cycles awake on the slowed clock (see sysclk_slow())
+enum { E_AWAKE, E_SEGMENTS, E_LINES = E_SEGMENTS + 6, E_ADC, E_SAVE, E_SLOW, E_REGIMES };
+
+// and what each costs, in uA. From power.txt's 2MHz figures (four digits, about
+// 20 segments, less the 0.1mA of the shutter transistor that was on while counting):
+// 0.4mA with the display dark, and the rest shared between the segments. An ADC
+// burst is 17 conversions (~3.7ms) at ~0.3mA, here as its charge over a cycle.
+// Power-save is the datasheet's, see "armed standby" in power.txt, and so is the
+// slowed clock's
+static const uint16_t micro_amps[E_REGIMES] PROGMEM = {
+    400,
+    410, 195, 95, 40, 15, 5,
+    100,
+    22,
+    1,
+    150
+};
+
+static uint32_t cycles[E_REGIMES];
+
+// two alkaline cells at a light load: percent of the charge left, by voltage
+// (in hundredths of a volt), high to low
+static const uint16_t discharge[][2] PROGMEM = {
+    { 310, 100 }, { 290, 85 }, { 270, 65 }, { 250, 40 }, { 230, 20 }, { 210, 7 }, { 190, 0 }
+};
+#define DISCHARGE_POINTS (sizeof(discharge) / sizeof(discharge[0]))
+
+void energy_cycle()
+{
+    uint8_t level;
+    uint8_t lit = display_lit(&level);
+    ++cycles[sysclk_slowed ? E_SLOW : E_AWAKE];
+    cycles[E_SEGMENTS + level] += lit;
+    cycles[E_LINES] += SHUTTER_LINES();
+}
+
+void energy_adc()
+{
+    ++cycles[E_ADC];
+}
+
+void energy_asleep(uint16_t secs)
+{
+    cycles[E_SAVE] += (uint32_t)secs * CYCLES_PER_SEC;
+}
+
+// n units of time at ua, in uAh, with per_hour units to the hour; split so it
+// doesn't overflow
+static uint32_t charge(uint32_t n, uint16_t ua, uint32_t per_hour)
+{
+    return n / per_hour * ua + n % per_hour * ua / per_hour;
+}
+
+// the counts, as of now; the input cycle's interrupt adds to them
+static void snapshot(uint32_t *c)
+{
+    cli();
+    memcpy(c, cycles, sizeof(cycles));
+    sei();
+}
+
+uint32_t energy_used()
+{
+    uint32_t c[E_REGIMES];
+    snapshot(c);
+    uint32_t uah = 0;
+    for (uint8_t i = 0; i < E_REGIMES; ++i)
+        uah += charge(c[i], pgm_read_word(&micro_amps[i]), CYCLES_PER_HOUR);
+    return uah;
+}
+
+uint32_t energy_left(uint16_t vcc)
+{
+    uint8_t i = 0;
+    while (i < DISCHARGE_POINTS - 1 && vcc < pgm_read_word(&discharge[i][0]))
+        ++i;
+    uint16_t lo_v = pgm_read_word(&discharge[i][0]);
+    uint16_t lo_p = pgm_read_word(&discharge[i][1]);
+    // a percent is ENERGY_BATTERY_MAH * 10 uAh
+    if (i == 0 || vcc <= lo_v)
+        return (uint32_t)lo_p * ENERGY_BATTERY_MAH * 10;
+    // between two points
+    uint16_t hi_v = pgm_read_word(&discharge[i - 1][0]);
+    uint16_t hi_p = pgm_read_word(&discharge[i - 1][1]);
+    return ((uint32_t)lo_p * (hi_v - lo_v) + (uint32_t)(hi_p - lo_p) * (vcc - lo_v))
+        * ENERGY_BATTERY_MAH * 10 / (hi_v - lo_v);
+}
+
+uint16_t energy_hours_left(uint16_t vcc)
+{
+    uint32_t c[E_REGIMES];
+    snapshot(c);
+    uint32_t secs = (c[E_AWAKE] + c[E_SLOW] + c[E_SAVE]) / CYCLES_PER_SEC;
+    uint32_t used = energy_used();
+    if (!secs || !used)
+        return 0xFFFF;
+    // average uA so far; 1.19Ah is as much as fits the multiply, more than the battery holds
+    if (used > 1190000)
+        used = 1190000;
+    uint32_t ua = used * 3600 / secs;
+    uint32_t tenths = energy_left(vcc) * 10 / (ua ? ua : 1);
+    return tenths > 0xFFFF ? 0xFFFF : tenths;
+}
+
+uint8_t energy_plan_fits(uint16_t vcc)
+{
+    if (!vcc)
+        return 1;
+
+    // ticks the sequence runs, and ticks the shutter line's on, phase by phase
+    // as sequence.c runs them: the half-press, the mirror (whose pulse is the
+    // first of its ticks) and the exposure each frame, and the delay (at least
+    // a tick) between frames, but not after the last
+    uint32_t exposure = time_ticks(stime);
+    uint32_t gap = time_ticks(delay);
+    if (!gap)
+        gap = 1;
+    uint32_t frame = (uint32_t)mlu * CLOCK_TICKS_PER_SEC + exposure
+        + (hpress == 2 ? CLOCK_TICKS_PER_SEC : 0);
+    uint32_t total, open;
+    if (exposure == 0) {
+        total = open = NIGHT_TICKS;
+    } else {
+        uint32_t frames = count ? count : NIGHT_TICKS / (frame + gap) + 1;
+        total = frame * frames + gap * (frames - 1) + (hpress == 1 ? CLOCK_TICKS_PER_SEC : 0);
+        open = (exposure + (mlu ? 1 : 0)) * frames;
+    }
+    // the half-press stays on through the exposure when it went on just before
+    uint8_t lines = (hpress == 2 && !mlu) ? 2 : 1;
+
+    // awake throughout, with the display lit; unless it times out (the
+    // heartbeat's too little to count), and then the clock slows down, in the
+    // builds that can. There's no separate budget for the idle sleep between
+    // input cycles: E_AWAKE is power.txt's average, which has it in already
+    uint16_t ua;
+    if (dim)
+#ifdef SYSCLK_SLOW
+        ua = pgm_read_word(&micro_amps[E_SLOW]);
+#else
+        ua = pgm_read_word(&micro_amps[E_AWAKE]);
+#endif
+    else
+        ua = pgm_read_word(&micro_amps[E_AWAKE]) + RUN_SEGMENTS * pgm_read_word(&micro_amps[E_SEGMENTS + bright]);
+    uint32_t need = charge(total, ua, TICKS_PER_HOUR)
+        + charge(open * lines, pgm_read_word(&micro_amps[E_LINES]), TICKS_PER_HOUR);
+    return need <= energy_left(vcc);
+}
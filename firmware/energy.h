@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+// Energy accounting: the time spent in each power regime since the batteries
+// went in (RAM survives power-save, so only a reset starts it over), turned into
+// charge with currents taken from power.txt. The regimes are: awake, the lit
+// display segments at each brightness level, the shutter and half-press
+// transistors, ADC bursts, power-save, and awake on the slowed clock.
+//
+// Charges are in uAh, and time in 50ms input cycles.
+
+// the battery the estimates assume: two AAA alkalines
+#define ENERGY_BATTERY_MAH 1000
+// how long a sequence without an end (count 0, or an open exposure) is taken to run
+#define ENERGY_NIGHT_HOURS 8
+
+// once an input cycle while awake, from the timer1 interrupt
+void energy_cycle();
+// once an ADC burst
+void energy_adc();
+// seconds spent in power-save
+void energy_asleep(uint16_t secs);
+
+// charge used so far
+uint32_t energy_used();
+// charge left, by the battery voltage (in hundredths of a volt, as read_vcc())
+uint32_t energy_left(uint16_t vcc);
+// hours the charge left lasts at the average draw so far, in tenths
+uint16_t energy_hours_left(uint16_t vcc);
+// nonzero if the sequence in settings.h, at the brightness and display timeout
+// set, should finish on the charge left (or if vcc couldn't be read)
+uint8_t energy_plan_fits(uint16_t vcc);
@@ -0,0 +1,310 @@
+// Command-line remote control for the astro-timer, over its serial port
+// (see remote.h for the protocol). Put the timer in remote mode first:
+// Opts -> "SEr" -> Set.
+//
+//   astro-remote DEVICE state
+//   astro-remote DEVICE config TIME DELAY COUNT [mlu SECS] [hpress 0|1|2]
+//   astro-remote DEVICE start
+//   astro-remote DEVICE stop
+//   astro-remote DEVICE watch
+//   astro-remote DEVICE log
+//
+// TIME and DELAY are [[H:]MM:]SS[.fff], rounded to the timer's 1/8 s steps.
+// watch prints state changes until interrupted. log reads the session log (see
+// log.h) and prints it, a line per record, oldest first.
+//
+// To try it without hardware, run the host simulator with -p and point this
+// at the pseudo-terminal it prints.
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "../remote.h"
+#include "../log.h"
+
+static const char *phases[] = { "idle", "half-press", "mirror-up", "exposing", "waiting" };
+
+static uint8_t crc8(uint8_t crc, uint8_t data)
+{
+    crc ^= data;
+    for (int i = 0; i < 8; ++i)
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    return crc;
+}
+
+static int open_port(const char *path)
+{
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        perror(path);
+        exit(1);
+    }
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, B9600);
+        cfsetospeed(&tio, B9600);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    return fd;
+}
+
+static void send_msg(int fd, uint8_t cmd, const uint8_t *data, uint8_t len)
+{
+    uint8_t buf[REMOTE_MAX_LEN + 3];
+    buf[0] = REMOTE_SYNC;
+    buf[1] = len + 1;
+    buf[2] = cmd;
+    memcpy(&buf[3], data, len);
+    uint8_t crc = 0;
+    for (int i = 1; i < len + 3; ++i)
+        crc = crc8(crc, buf[i]);
+    buf[len + 3] = crc;
+    if (write(fd, buf, len + 4) != len + 4) {
+        perror("write");
+        exit(1);
+    }
+}
+
+// wait up to timeout_ms for a message; returns its length (CMD + DATA) or 0
+static int recv_msg(int fd, uint8_t *msg, int timeout_ms)
+{
+    int pos = 0, len = 0;
+    uint8_t crc = 0;
+    struct pollfd p = { fd, POLLIN, 0 };
+    while (poll(&p, 1, timeout_ms) > 0) {
+        uint8_t b;
+        if (read(fd, &b, 1) != 1)
+            return 0;
+        if (pos == 0) {
+            if (b == REMOTE_SYNC)
+                pos = 1;
+        } else if (pos == 1) {
+            if (b == 0 || b > REMOTE_MAX_LEN) {
+                pos = (b == REMOTE_SYNC);
+                continue;
+            }
+            len = b;
+            crc = crc8(0, b);
+            pos = 2;
+        } else if (pos < len + 2) {
+            msg[pos - 2] = b;
+            crc = crc8(crc, b);
+            ++pos;
+        } else {
+            if (b == crc)
+                return len;
+            fprintf(stderr, "bad CRC; message dropped\n");
+            pos = 0;
+        }
+    }
+    return 0;
+}
+
+// the reply to a command, skipping any events that arrive first
+static int reply(int fd, uint8_t want, uint8_t *msg)
+{
+    for (;;) {
+        int len = recv_msg(fd, msg, 1000);
+        if (len == 0) {
+            fprintf(stderr, "no reply; is the timer in remote mode?\n");
+            exit(1);
+        }
+        if (msg[0] == want)
+            return len;
+    }
+}
+
+static const char *phase_name(uint8_t p)
+{
+    return p < sizeof(phases) / sizeof(phases[0]) ? phases[p] : "?";
+}
+
+// [[H:]MM:]SS[.fff] -> minutes, seconds, 1/8 s ticks
+static void parse_time(const char *s, uint8_t *out)
+{
+    unsigned m = 0;
+    double sec;
+    const char *colon;
+    while ((colon = strchr(s, ':'))) {
+        m = m * 60 + atoi(s);
+        s = colon + 1;
+    }
+    char *end;
+    sec = strtod(s, &end);
+    if (*end || sec < 0 || sec >= 60 || m > 240) {
+        fprintf(stderr, "bad time '%s'\n", s);
+        exit(2);
+    }
+    unsigned ticks = (unsigned)(sec * 8 + 0.5);
+    out[0] = m + ticks / 480;
+    out[1] = (ticks / 8) % 60;
+    out[2] = ticks % 8;
+}
+
+// 1/8 s ticks as [H:]MM:SS[.fff]
+static void print_clock(uint32_t ticks)
+{
+    unsigned secs = ticks / 8;
+    if (secs >= 3600)
+        printf("%u:", secs / 3600);
+    printf("%02u:%02u", secs / 60 % 60, secs % 60);
+    if (ticks % 8)
+        printf(".%03u", (unsigned)(ticks % 8) * 125);
+}
+
+static unsigned u16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static int ack(int fd)
+{
+    uint8_t msg[REMOTE_MAX_LEN];
+    reply(fd, REMOTE_ACK, msg);
+    switch (msg[1]) {
+    case REMOTE_OK:
+        return 0;
+    case REMOTE_BUSY:
+        fprintf(stderr, "refused: a sequence is running\n");
+        return 1;
+    default:
+        fprintf(stderr, "refused: invalid request\n");
+        return 1;
+    }
+}
+
+// print the session log's records; frames are numbered within each session
+static void print_log(const uint8_t *b, unsigned size)
+{
+    unsigned i = 0, frame = 0, ticks = 0;
+    int exposed = -1;   // from a LOG_FRAME, for the next frame byte
+    while (i < size) {
+        uint8_t r = b[i];
+        if (r < 0x80) {
+            // sign-extend the 4- and 3-bit changes
+            int dv = ((r >> 3) & 0xF) - ((r & 0x40) ? 16 : 0);
+            int dt = (r & 0x7) - ((r & 0x4) ? 8 : 0);
+            printf("  frame %u: ", ++frame);
+            print_clock(exposed >= 0 ? (unsigned)exposed : ticks);
+            printf(", battery %+dmV, temperature %+d\n", dv * 20, dt);
+            exposed = -1;
+            i += 1;
+        } else if (r == LOG_SESSION && i + 4 < size) {
+            frame = 0;
+            ticks = u16(&b[i + 1]);
+            printf("session: ");
+            print_clock(ticks);
+            printf(" exposures, battery %umV, temperature %u\n", b[i + 3] * 20, b[i + 4] + 128);
+            i += 5;
+        } else if (r == LOG_FRAME && i + 4 < size) {
+            frame = u16(&b[i + 1]) - 1;
+            exposed = u16(&b[i + 3]);
+            i += 5;
+        } else if (r == LOG_SENSORS && i + 2 < size) {
+            printf("  battery %umV, temperature %u\n", b[i + 1] * 20, b[i + 2] + 128);
+            i += 3;
+        } else if (r == LOG_CANCEL && i + 2 < size) {
+            printf("  frame %u: cancelled after ", ++frame);
+            print_clock(u16(&b[i + 1]));
+            printf("\n");
+            i += 3;
+        } else {
+            // padding, or a record cut off where the ring wrapped
+            i += 1;
+        }
+    }
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: astro-remote DEVICE state\n"
+        "       astro-remote DEVICE config TIME DELAY COUNT [mlu SECS] [hpress 0|1|2]\n"
+        "       astro-remote DEVICE start|stop|watch|log\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+        usage();
+    int fd = open_port(argv[1]);
+    const char *cmd = argv[2];
+    uint8_t msg[REMOTE_MAX_LEN];
+
+    if (!strcmp(cmd, "state")) {
+        send_msg(fd, REMOTE_GET_STATE, NULL, 0);
+        reply(fd, REMOTE_STATE, msg);
+        printf("%s ", phase_name(msg[1]));
+        print_clock(msg[2] | msg[3] << 8 | msg[4] << 16 | (uint32_t)msg[5] << 24);
+        printf(", %u to go, %u done\n", u16(&msg[6]), u16(&msg[8]));
+        return 0;
+    } else if (!strcmp(cmd, "config") && argc >= 6) {
+        uint8_t cfg[10] = { 0 };
+        parse_time(argv[3], &cfg[0]);
+        parse_time(argv[4], &cfg[3]);
+        unsigned n = atoi(argv[5]);
+        cfg[6] = n & 0xFF;
+        cfg[7] = n >> 8;
+        cfg[9] = 1;
+        for (int i = 6; i + 1 < argc; i += 2) {
+            if (!strcmp(argv[i], "mlu"))
+                cfg[8] = atoi(argv[i + 1]);
+            else if (!strcmp(argv[i], "hpress"))
+                cfg[9] = atoi(argv[i + 1]);
+            else
+                usage();
+        }
+        send_msg(fd, REMOTE_SET_CONFIG, cfg, sizeof(cfg));
+        return ack(fd);
+    } else if (!strcmp(cmd, "start")) {
+        send_msg(fd, REMOTE_START, NULL, 0);
+        return ack(fd);
+    } else if (!strcmp(cmd, "stop")) {
+        send_msg(fd, REMOTE_STOP, NULL, 0);
+        return ack(fd);
+    } else if (!strcmp(cmd, "log")) {
+        uint8_t *buf = NULL;
+        unsigned size = 1, pos = 0;
+        while (pos < size) {
+            uint8_t req[2] = { pos & 0xFF, pos >> 8 };
+            send_msg(fd, REMOTE_GET_LOG, req, sizeof(req));
+            int len = reply(fd, REMOTE_LOG, msg);
+            if (!buf) {
+                size = u16(&msg[1]);
+                buf = malloc(size ? size : 1);
+            }
+            // a reply with no bytes before the end, or more than asked for,
+            // means the log changed underneath us
+            if (len < 5 || u16(&msg[3]) != pos || u16(&msg[1]) != size
+                || (pos < size && len == 5) || pos + (len - 5) > size) {
+                fprintf(stderr, "bad log reply\n");
+                return 1;
+            }
+            memcpy(&buf[pos], &msg[5], len - 5);
+            pos += len - 5;
+        }
+        print_log(buf, pos);
+        free(buf);
+        return 0;
+    } else if (!strcmp(cmd, "watch")) {
+        for (;;) {
+            int len = recv_msg(fd, msg, -1);
+            if (len >= 6 && msg[0] == REMOTE_EVENT) {
+                printf("%s, %u to go, %u done\n", phase_name(msg[1]), u16(&msg[2]), u16(&msg[4]));
+                fflush(stdout);
+            }
+        }
+    }
+    usage();
+    return 2;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+// host stand-in for <avr/boot.h>
+
+#include "io.h"
+
+#define boot_signature_byte_get(addr) sim_signature_byte(addr)
@@ -0,0 +1,18 @@
+#pragma once
+
+// host stand-in for <avr/eeprom.h>, backed by the simulator's EEPROM image
+
+#include <stddef.h>
+#include <stdint.h>
+#include <avr/io.h>
+
+#define EEMEM
+
+uint8_t eeprom_read_byte(const uint8_t *addr);
+void eeprom_write_byte(uint8_t *addr, uint8_t value);
+void eeprom_update_byte(uint8_t *addr, uint8_t value);
+void eeprom_read_block(void *dst, const void *src, size_t n);
+void eeprom_update_block(const void *src, void *dst, size_t n);
+
+#define eeprom_is_ready() (!(EECR & _BV(EEPE)))
+#define eeprom_busy_wait() do {} while (!eeprom_is_ready())
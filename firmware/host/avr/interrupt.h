@@ -0,0 +1,11 @@
+#pragma once
+
+// host stand-in for <avr/interrupt.h>: an ISR is an ordinary function that the
+// simulator calls when its (virtual) interrupt fires
+
+#include "io.h"
+
+#define ISR(vector, ...) void vector(void); void vector(void)
+
+#define sei() sim_sei()
+#define cli() sim_cli()
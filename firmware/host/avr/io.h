@@ -0,0 +1,186 @@
+#pragma once
+
+// host stand-in for <avr/io.h>: the ATmega328P registers used by the firmware
+// become plain variables owned by the simulator (see sim.c)
+
+#include <stdint.h>
+#include "../sim.h"
+
+#define SIM_REG8(r)  extern volatile uint8_t r;
+#define SIM_REG16(r) extern volatile uint16_t r;
+#include "../sim_regs.h"
+#undef SIM_REG8
+#undef SIM_REG16
+
+// reading the inputs costs a few cycles, so busy-waits on a button make progress
+#define PINC (sim_read_pinc())
+// reading EEDR after setting EERE fetches the byte at EEAR
+#define EEDR (*sim_eedr())
+#define EEARL EEAR
+
+#define _BV(bit) (1 << (bit))
+
+#define E2END  0x3FF
+#define RAMEND 0x8FF
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+// TCCR0A / TCCR0B / TIMSK0 / TIFR0
+#define WGM00  0
+#define WGM01  1
+#define CS00   0
+#define CS01   1
+#define CS02   2
+#define WGM02  3
+#define TOIE0  0
+#define OCIE0A 1
+#define OCIE0B 2
+#define TOV0   0
+#define OCF0A  1
+#define OCF0B  2
+
+// TCCR1B / TIMSK1 / TIFR1
+#define CS10   0
+#define CS11   1
+#define CS12   2
+#define WGM12  3
+#define WGM13  4
+#define TOIE1  0
+#define OCIE1A 1
+#define OCIE1B 2
+#define TOV1   0
+#define OCF1A  1
+#define OCF1B  2
+
+// TCCR2A / TCCR2B / TIMSK2 / TIFR2 / ASSR
+#define WGM20  0
+#define WGM21  1
+#define CS20   0
+#define CS21   1
+#define CS22   2
+#define WGM22  3
+#define TOIE2  0
+#define OCIE2A 1
+#define OCIE2B 2
+#define TOV2   0
+#define OCF2A  1
+#define OCF2B  2
+#define TCR2BUB 0
+#define TCR2AUB 1
+#define OCR2BUB 2
+#define OCR2AUB 3
+#define TCN2UB  4
+#define AS2     5
+#define EXCLK   6
+#define PSRASY  1
+#define PSRSYNC 0
+#define TSM     7
+
+// PCICR / PCIFR / PCMSK1
+#define PCIE0  0
+#define PCIE1  1
+#define PCIE2  2
+#define PCIF0  0
+#define PCIF1  1
+#define PCIF2  2
+#define PCINT8  0
+#define PCINT9  1
+#define PCINT10 2
+#define PCINT11 3
+#define PCINT12 4
+#define PCINT13 5
+
+// ADMUX / ADCSRA
+#define MUX0   0
+#define MUX1   1
+#define MUX2   2
+#define MUX3   3
+#define ADLAR  5
+#define REFS0  6
+#define REFS1  7
+#define ADPS0  0
+#define ADPS1  1
+#define ADPS2  2
+#define ADIE   3
+#define ADIF   4
+#define ADATE  5
+#define ADSC   6
+#define ADEN   7
+
+// EECR
+#define EERE   0
+#define EEPE   1
+#define EEMPE  2
+#define EERIE  3
+
+// UCSR0A / UCSR0B / UCSR0C
+#define MPCM0  0
+#define U2X0   1
+#define UPE0   2
+#define DOR0   3
+#define FE0    4
+#define UDRE0  5
+#define TXC0   6
+#define RXC0   7
+#define TXB80  0
+#define RXB80  1
+#define UCSZ02 2
+#define TXEN0  3
+#define RXEN0  4
+#define UDRIE0 5
+#define TXCIE0 6
+#define RXCIE0 7
+#define UCSZ00 1
+#define UCSZ01 2
+
+// SMCR / MCUCR
+#define SE     0
+#define SM0    1
+#define SM1    2
+#define SM2    3
+#define PUD    4
+#define BODSE  5
+#define BODS   6
+
+// CLKPR
+#define CLKPS0 0
+#define CLKPS1 1
+#define CLKPS2 2
+#define CLKPS3 3
+#define CLKPCE 7
+
+// PRR
+#define PRADC    0
+#define PRUSART0 1
+#define PRSPI    2
+#define PRTIM1   3
+#define PRTIM0   5
+#define PRTIM2   6
+#define PRTWI    7
+
+// ACSR
+#define ACD    7
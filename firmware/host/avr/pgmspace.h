@@ -0,0 +1,17 @@
+#pragma once
+
+// host stand-in for <avr/pgmspace.h>: there is only one address space here
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+#define pgm_read_byte(addr)  (*(const uint8_t *)(addr))
+#define pgm_read_word(addr)  (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define pgm_read_ptr(addr)   (*(const void * const *)(addr))
+
+#define memcpy_P memcpy
+#define strlen_P strlen
@@ -0,0 +1,20 @@
+#pragma once
+
+// host stand-in for <avr/power.h>: the clock prescaler only, which the
+// simulator reads back from CLKPR
+
+#include "io.h"
+
+typedef enum {
+    clock_div_1 = 0,
+    clock_div_2 = 1,
+    clock_div_4 = 2,
+    clock_div_8 = 3,
+    clock_div_16 = 4,
+    clock_div_32 = 5,
+    clock_div_64 = 6,
+    clock_div_128 = 7,
+    clock_div_256 = 8
+} clock_div_t;
+
+#define clock_prescale_set(x) do { CLKPR = _BV(CLKPCE); CLKPR = (x); } while (0)
@@ -0,0 +1,21 @@
+#pragma once
+
+// host stand-in for <avr/sleep.h>: sleeping hands control to the simulator,
+// which runs the virtual clock forward until an interrupt wakes the CPU
+
+#include "io.h"
+
+#define SLEEP_MODE_IDLE         0
+#define SLEEP_MODE_ADC          _BV(SM0)
+#define SLEEP_MODE_PWR_DOWN     _BV(SM1)
+#define SLEEP_MODE_PWR_SAVE     (_BV(SM0) | _BV(SM1))
+#define SLEEP_MODE_STANDBY      (_BV(SM1) | _BV(SM2))
+#define SLEEP_MODE_EXT_STANDBY  (_BV(SM0) | _BV(SM1) | _BV(SM2))
+
+#define set_sleep_mode(mode) (SMCR = (SMCR & ~(_BV(SM0) | _BV(SM1) | _BV(SM2))) | (mode))
+#define sleep_enable()       (SMCR |= _BV(SE))
+#define sleep_disable()      (SMCR &= ~_BV(SE))
+#define sleep_cpu()          sim_sleep()
+#define sleep_bod_disable()
+
+#define sleep_mode() do { sleep_enable(); sleep_cpu(); sleep_disable(); } while (0)
@@ -0,0 +1,648 @@
+// End-to-end timing bench for the AVR build, running main.elf under simavr
+//
+// Drives the encoder and keys (PC0..PC4) from a host simulator script (see sim.c;
+// press, down, up, turn and end are acted on, and the simulator's own checks are
+// skipped), and timestamps every full-press (PB5) and half-press (PC5) edge to the
+// cycle. Each sequence's edges are checked against the plan it was started with,
+// read out of SRAM (stime, delay, count, mlu, hpress) at its first edge: the
+// half-press second, the mirror-up pulse and mlu wait, the exposure and the delay
+// must each last what the plan says, to within -x microseconds, and the sequence
+// must end after count frames. With count 0 it runs until Start cancels it, as may
+// any sequence; the shutter must then close within -c milliseconds of the press.
+// An exposure of 0 is open-ended, and only ends on a cancel.
+//
+// The first tick of a sequence comes up to a timer2 count (1/256 s) after its first
+// edge, since the sequence starts between counts, so that one interval gets the
+// extra allowance; every later edge is timed from the one before.
+//
+// UI latency is the time from each key press or encoder detent to the next change
+// in display[] (the refresh buffer); inputs that change nothing within a second
+// aren't counted.
+//
+// usage: avr-bench [options] main.elf main.sym script
+//   main.sym is `avr-nm main.elf` output, used to find the plan and display[]
+//   -m mcu        simavr core name (default atmega328p)
+//   -f hz         CPU clock (default 2000000)
+//   -x us         edge timing tolerance (default 500)
+//   -c ms         cancel-to-shutter-closed limit (default 10)
+//   -v            print every shutter edge
+// Exits 1 if any check fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_cycle_timers.h>
+#include <simavr/avr_ioport.h>
+
+#include "../clock.h"
+
+#define SRAM_OFFSET 0x800000
+
+static uint32_t freq = 2000000;
+static int verbose;
+
+static double ms(uint64_t cycles)
+{
+    return 1000.0 * cycles / freq;
+}
+
+// -- script: just the pin changes, in cycles
+
+struct pin_event {
+    uint64_t at;
+    uint32_t seq;
+    uint8_t mask, level;
+    uint8_t input;      // a key press or the end of a detent: the UI should respond
+};
+
+static struct pin_event *events;
+static size_t num_events, cap_events, next_event;
+static uint64_t end_at;
+
+static void add_pin_event(uint64_t at, uint8_t mask, uint8_t level, uint8_t input)
+{
+    if (num_events == cap_events) {
+        cap_events = cap_events ? cap_events * 2 : 256;
+        events = realloc(events, cap_events * sizeof(*events));
+    }
+    struct pin_event *e = &events[num_events];
+    e->at = at;
+    e->seq = num_events++;
+    e->mask = mask;
+    e->level = level;
+    e->input = input;
+}
+
+static int event_cmp(const void *a, const void *b)
+{
+    const struct pin_event *x = a, *y = b;
+    if (x->at != y->at)
+        return x->at < y->at ? -1 : 1;
+    return x->seq < y->seq ? -1 : 1;
+}
+
+static uint64_t parse_time(const char *s, uint64_t prev, int line)
+{
+    int rel = (*s == '+');
+    char *end;
+    double t = strtod(s + rel, &end);
+    if (end == s + rel) {
+        fprintf(stderr, "line %d: bad time '%s'\n", line, s);
+        exit(2);
+    }
+    if (*end == 'm') t *= 60;
+    else if (*end == 'h') t *= 3600;
+    else if (*end == 'u') t /= 1e6;
+    uint64_t c = (uint64_t)(t * freq + 0.5);
+    return rel ? prev + c : c;
+}
+
+static uint8_t parse_buttons(const char *s, int line)
+{
+    uint8_t mask = 0;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s", s);
+    for (char *b = strtok(buf, "+"); b; b = strtok(NULL, "+")) {
+        if (!strcmp(b, "start")) mask |= 1 << 2;
+        else if (!strcmp(b, "select")) mask |= 1 << 3;
+        else if (!strcmp(b, "set")) mask |= 1 << 4;
+        else {
+            fprintf(stderr, "line %d: unknown button '%s'\n", line, b);
+            exit(2);
+        }
+    }
+    return mask;
+}
+
+// as the simulator does it: four edges a detent, 1ms apart (or closer for a quick spin)
+static void turn(uint64_t at, int detents, int period_ms)
+{
+    uint64_t edge = period_ms < 8 ? (uint64_t)freq / 8000 * period_ms : freq / 1000;
+    static const uint8_t cw[4] = { 0b10, 0b00, 0b01, 0b11 };
+    static const uint8_t ccw[4] = { 0b01, 0b00, 0b10, 0b11 };
+    const uint8_t *seq = detents > 0 ? cw : ccw;
+    int n = detents > 0 ? detents : -detents;
+    for (int d = 0; d < n; ++d) {
+        for (int i = 0; i < 4; ++i) {
+            uint64_t t = at + (uint64_t)d * (freq / 1000 * period_ms) + i * edge;
+            add_pin_event(t, 0b11 & ~seq[i], 0, 0);
+            add_pin_event(t, seq[i], 1, i == 3);
+        }
+    }
+}
+
+static void load_script(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    char line[256];
+    uint64_t prev = 0;
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        ++lineno;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = 0;
+        char *argv[4] = { 0 };
+        int argc = 0;
+        for (char *tok = strtok(line, " \t\r\n"); tok && argc < 4; tok = strtok(NULL, " \t\r\n"))
+            argv[argc++] = tok;
+        if (argc < 2)
+            continue;
+        uint64_t at = parse_time(argv[0], prev, lineno);
+        prev = at;
+        const char *cmd = argv[1];
+        if (!strcmp(cmd, "press") && argc >= 3) {
+            uint8_t mask = parse_buttons(argv[2], lineno);
+            uint64_t hold = argc >= 4 ? parse_time(argv[3], 0, lineno) : freq / 10;
+            add_pin_event(at, mask, 0, 1);
+            add_pin_event(at + hold, mask, 1, 0);
+        } else if (!strcmp(cmd, "down") && argc >= 3) {
+            add_pin_event(at, parse_buttons(argv[2], lineno), 0, 1);
+        } else if (!strcmp(cmd, "up") && argc >= 3) {
+            add_pin_event(at, parse_buttons(argv[2], lineno), 1, 0);
+        } else if (!strcmp(cmd, "turn") && argc >= 3) {
+            turn(at, atoi(argv[2]), argc >= 4 ? atoi(argv[3]) : 30);
+        } else if (!strcmp(cmd, "end")) {
+            end_at = at;
+        }
+    }
+    fclose(f);
+    qsort(events, num_events, sizeof(*events), event_cmp);
+    if (!end_at)
+        end_at = (num_events ? events[num_events - 1].at : 0) + freq;
+}
+
+// -- the firmware's variables
+
+struct symbol {
+    const char *name;
+    uint32_t addr;
+};
+
+static struct symbol symbols[] = {
+    { "stime" }, { "delay" }, { "count" }, { "mlu" }, { "hpress" }, { "display" },
+};
+enum { SYM_STIME, SYM_DELAY, SYM_COUNT, SYM_MLU, SYM_HPRESS, SYM_DISPLAY, NUM_SYMBOLS };
+
+static void load_symbols(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    char line[256], name[200], type;
+    unsigned addr;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%x %c %199s", &addr, &type, name) != 3 || addr < SRAM_OFFSET)
+            continue;
+        for (int i = 0; i < NUM_SYMBOLS; ++i)
+            if (!strcmp(symbols[i].name, name))
+                symbols[i].addr = addr - SRAM_OFFSET;
+    }
+    fclose(f);
+    for (int i = 0; i < NUM_SYMBOLS; ++i) {
+        if (!symbols[i].addr) {
+            fprintf(stderr, "avr-bench: '%s' isn't in %s\n", symbols[i].name, path);
+            exit(2);
+        }
+    }
+}
+
+struct plan {
+    uint32_t exposure, delay;   // ticks
+    uint16_t count;
+    uint8_t mlu, hpress;
+};
+
+static uint32_t time_ticks(const uint8_t *t)
+{
+    return ((uint32_t)t[0] * 60 + t[1]) * CLOCK_TICKS_PER_SEC + t[2];
+}
+
+static struct plan read_plan(avr_t *avr)
+{
+    struct plan p;
+    p.exposure = time_ticks(&avr->data[symbols[SYM_STIME].addr]);
+    p.delay = time_ticks(&avr->data[symbols[SYM_DELAY].addr]);
+    if (p.delay == 0)
+        p.delay = 1;
+    p.count = avr->data[symbols[SYM_COUNT].addr] | avr->data[symbols[SYM_COUNT].addr + 1] << 8;
+    p.mlu = avr->data[symbols[SYM_MLU].addr];
+    p.hpress = avr->data[symbols[SYM_HPRESS].addr];
+    return p;
+}
+
+// -- recording
+
+#define LINE_FULL 0
+#define LINE_HALF 1
+static const char *line_names[] = { "full-press", "half-press" };
+
+struct edge {
+    uint64_t at;
+    uint8_t line, on;
+    struct plan plan;   // as it stood when the edge went out
+};
+
+static struct edge *edges;
+static size_t num_edges, cap_edges;
+static uint64_t *presses;   // Start going down
+static size_t num_presses, cap_presses;
+
+static avr_t *avr;
+static avr_irq_t *pinc[5];
+static uint8_t line_state[2];
+
+static void shutter_edge(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    uint8_t line = (uint8_t)(uintptr_t)param;
+    if (!!value == line_state[line])
+        return;
+    line_state[line] = !!value;
+    if (num_edges == cap_edges) {
+        cap_edges = cap_edges ? cap_edges * 2 : 1024;
+        edges = realloc(edges, cap_edges * sizeof(*edges));
+    }
+    struct edge *e = &edges[num_edges++];
+    e->at = avr->cycle;
+    e->line = line;
+    e->on = line_state[line];
+    e->plan = read_plan(avr);
+    if (verbose)
+        printf("%12.6f  %s %s\n", (double)e->at / freq, line_names[line], e->on ? "on" : "off");
+}
+
+// UI latency: inputs waiting for the display to change
+static uint64_t pending[64];
+static int num_pending;
+static double *latencies;
+static size_t num_latencies, cap_latencies;
+
+static void add_sample(double **v, size_t *n, size_t *cap, double x)
+{
+    if (*n == *cap) {
+        *cap = *cap ? *cap * 2 : 256;
+        *v = realloc(*v, *cap * sizeof(**v));
+    }
+    (*v)[(*n)++] = x;
+}
+
+static avr_cycle_count_t script_tick(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+    while (next_event < num_events && events[next_event].at <= when) {
+        struct pin_event *e = &events[next_event++];
+        for (int i = 0; i < 5; ++i)
+            if (e->mask & (1 << i))
+                avr_raise_irq(pinc[i], e->level);
+        if ((e->mask & (1 << 2)) && !e->level) {
+            if (num_presses == cap_presses) {
+                cap_presses = cap_presses ? cap_presses * 2 : 64;
+                presses = realloc(presses, cap_presses * sizeof(*presses));
+            }
+            presses[num_presses++] = e->at;
+        }
+        if (e->input) {
+            // forget the ones that never showed
+            int n = 0;
+            for (int i = 0; i < num_pending; ++i)
+                if (e->at - pending[i] < freq)
+                    pending[n++] = pending[i];
+            num_pending = n;
+            if (num_pending < 64)
+                pending[num_pending++] = e->at;
+        }
+    }
+    return next_event < num_events ? events[next_event].at : 0;
+}
+
+static void display_changed(uint64_t now)
+{
+    for (int i = 0; i < num_pending; ++i)
+        if (now - pending[i] < freq)
+            add_sample(&latencies, &num_latencies, &cap_latencies, ms(now - pending[i]));
+    num_pending = 0;
+}
+
+// -- checking
+
+enum { HALF_ON, MIRROR_ON, MIRROR_OFF, EXPOSE_ON, EXPOSE_OFF, HALF_OFF };
+static const char *kind_names[] = {
+    "half-press on", "mirror-up on", "mirror-up off", "exposure on", "exposure off", "half-press off",
+};
+static const uint8_t kind_line[] = { LINE_HALF, LINE_FULL, LINE_FULL, LINE_FULL, LINE_FULL, LINE_HALF };
+static const uint8_t kind_on[] = { 1, 1, 0, 1, 0, 0 };
+
+struct expected {
+    uint64_t tick;      // from the start of the sequence
+    uint8_t kind;
+    uint8_t open;       // an open-ended exposure's end: only a cancel brings it
+};
+
+static struct expected *plan_edges;
+static size_t num_plan, cap_plan;
+
+static void expect(uint64_t tick, uint8_t kind, uint8_t open)
+{
+    if (num_plan == cap_plan) {
+        cap_plan = cap_plan ? cap_plan * 2 : 1024;
+        plan_edges = realloc(plan_edges, cap_plan * sizeof(*plan_edges));
+    }
+    plan_edges[num_plan++] = (struct expected){ tick, kind, open };
+}
+
+// the edges a plan makes, as sequence.c runs it, up to `ticks` in
+static void make_plan(const struct plan *p, uint64_t ticks)
+{
+    num_plan = 0;
+    uint64_t t = 0;
+    for (uint32_t frame = 0; p->count == 0 || frame < p->count; ++frame) {
+        if (t > ticks)
+            break;
+        uint8_t half = p->hpress > 1 || (p->hpress == 1 && frame == 0);
+        if (half) {
+            expect(t, HALF_ON, 0);
+            t += CLOCK_TICKS_PER_SEC;
+        }
+        if (p->mlu) {
+            expect(t, MIRROR_ON, 0);
+            expect(t + 1, MIRROR_OFF, 0);
+            if (half)
+                expect(t + 1, HALF_OFF, 0);
+            half = 0;
+            t += (uint64_t)p->mlu * CLOCK_TICKS_PER_SEC;
+        }
+        expect(t, EXPOSE_ON, 0);
+        if (p->exposure == 0) {
+            expect(UINT64_MAX, EXPOSE_OFF, 1);
+            break;
+        }
+        t += p->exposure;
+        expect(t, EXPOSE_OFF, 0);
+        if (half)
+            expect(t, HALF_OFF, 0);
+        t += p->delay;
+    }
+}
+
+struct stats {
+    const char *name;
+    double *v;
+    size_t n, cap;
+};
+
+static struct stats exposure_error = { "exposure error (ms)" };
+static struct stats dead_time = { "dead time (ms)" };
+static struct stats dead_error = { "dead time error (ms)" };
+static struct stats edge_error = { "edge error (ms)" };
+static struct stats start_latency = { "Start to first edge (ms)" };
+static struct stats cancel_latency = { "Start to shutter closed (ms)" };
+static int failures;
+
+static void fail(uint64_t at, const char *what, const char *detail)
+{
+    printf("%12.6f  FAIL: %s%s\n", (double)at / freq, what, detail);
+    ++failures;
+}
+
+// the first Start press in (from, to]
+static uint64_t press_between(uint64_t from, uint64_t to)
+{
+    for (size_t i = 0; i < num_presses; ++i)
+        if (presses[i] > from && presses[i] <= to)
+            return presses[i];
+    return 0;
+}
+
+// check the sequence whose first edge is edges[i]; returns the index after its last
+static size_t check_sequence(size_t i, uint64_t tolerance, uint64_t cancel_limit)
+{
+    const struct edge *first = &edges[i];
+    const struct plan *p = &first->plan;
+    uint64_t tick = freq / CLOCK_TICKS_PER_SEC;
+    uint64_t slack = freq / (CLOCK_STEP * CLOCK_TICKS_PER_SEC);
+    make_plan(p, (end_at - first->at) / tick + 1);
+    printf("%12.6f  sequence: %.3f s exposures, %.3f s delay, count %u, mlu %u, half-press %u\n",
+           (double)first->at / freq, (double)p->exposure / CLOCK_TICKS_PER_SEC,
+           (double)p->delay / CLOCK_TICKS_PER_SEC, p->count, p->mlu, p->hpress);
+
+    // the press that started it
+    for (size_t k = num_presses; k-- > 0;) {
+        if (presses[k] <= first->at) {
+            if (first->at - presses[k] < freq)
+                add_sample(&start_latency.v, &start_latency.n, &start_latency.cap, ms(first->at - presses[k]));
+            break;
+        }
+    }
+
+    // a Start press only cancels if the plan isn't already over
+    uint64_t plan_end = plan_edges[num_plan - 1].open ? UINT64_MAX
+                      : first->at + plan_edges[num_plan - 1].tick * tick + slack + tolerance;
+
+    size_t next[2] = { 0, 0 };      // per line, the next plan edge to match
+    uint64_t prev_at = 0, prev_tick = 0, expose_on = 0, expose_end = 0, expose_end_tick = 0;
+    uint64_t cancel = 0;
+    uint8_t on[2] = { 0, 0 };
+    size_t j = i;
+    for (; j < num_edges; ++j) {
+        const struct edge *e = &edges[j];
+
+        // a cancel: every line that's on goes off, promptly, and that's the end
+        if (!cancel)
+            cancel = press_between(prev_at ? prev_at : first->at, e->at < plan_end ? e->at : plan_end);
+        if (cancel) {
+            if (e->on || !on[e->line])
+                break;
+            on[e->line] = 0;
+            if (e->at - cancel > cancel_limit)
+                fail(e->at, line_names[e->line], " closed late after a cancel");
+            add_sample(&cancel_latency.v, &cancel_latency.n, &cancel_latency.cap, ms(e->at - cancel));
+            if (!on[0] && !on[1]) {
+                ++j;
+                break;
+            }
+            continue;
+        }
+
+        // find this line's next planned edge
+        size_t k = next[e->line];
+        while (k < num_plan && kind_line[plan_edges[k].kind] != e->line)
+            ++k;
+        if (k == num_plan) {
+            // the plan's done, so this starts the next sequence
+            break;
+        }
+        const struct expected *x = &plan_edges[k];
+        if (kind_on[x->kind] != e->on || x->open) {
+            fail(e->at, line_names[e->line], e->on ? " on unexpectedly" : " off unexpectedly");
+            if (j == i)
+                ++j;
+            break;
+        }
+        next[e->line] = k + 1;
+        on[e->line] = e->on;
+
+        if (j > i) {
+            int64_t err = (int64_t)(e->at - prev_at) - (int64_t)((x->tick - prev_tick) * tick);
+            uint64_t allowed = tolerance + (prev_tick == 0 && x->tick > 0 ? slack : 0);
+            add_sample(&edge_error.v, &edge_error.n, &edge_error.cap, err * 1000.0 / freq);
+            if ((uint64_t)llabs(err) > allowed) {
+                char detail[64];
+                snprintf(detail, sizeof(detail), " %+.3f ms off the plan", err * 1000.0 / freq);
+                fail(e->at, kind_names[x->kind], detail);
+            }
+        }
+        if (x->kind == EXPOSE_ON) {
+            if (expose_end) {
+                // from one exposure's end to the next one's start: the delay, and
+                // any half-press second and mirror lockup
+                double planned = 1000.0 * (x->tick - expose_end_tick) / CLOCK_TICKS_PER_SEC;
+                add_sample(&dead_time.v, &dead_time.n, &dead_time.cap, ms(e->at - expose_end));
+                add_sample(&dead_error.v, &dead_error.n, &dead_error.cap, ms(e->at - expose_end) - planned);
+            }
+            expose_on = e->at;
+        } else if (x->kind == EXPOSE_OFF) {
+            double err = ms(e->at - expose_on) - 1000.0 * p->exposure / CLOCK_TICKS_PER_SEC;
+            add_sample(&exposure_error.v, &exposure_error.n, &exposure_error.cap, err);
+            expose_end = e->at;
+            expose_end_tick = x->tick;
+        }
+        prev_at = e->at;
+        prev_tick = x->tick;
+    }
+
+    // planned edges that should have come before the next sequence (or the end,
+    // or a cancel)
+    uint64_t until = (j < num_edges) ? edges[j].at : end_at;
+    if (!cancel)
+        cancel = press_between(prev_at, until < plan_end ? until : plan_end);
+    if (cancel && cancel < until)
+        until = cancel;
+    for (size_t m = (next[0] < next[1] ? next[0] : next[1]); m < num_plan; ++m) {
+        const struct expected *x = &plan_edges[m];
+        if (m < next[kind_line[x->kind]] || x->open)
+            continue;
+        if (first->at + x->tick * tick + slack + tolerance < until) {
+            char detail[64];
+            snprintf(detail, sizeof(detail), " missing (%s)", kind_names[x->kind]);
+            fail(until, line_names[kind_line[x->kind]], detail);
+            break;
+        }
+    }
+    if (cancel)
+        printf("%12.6f  cancelled\n", (double)cancel / freq);
+    return j > i ? j : i + 1;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(struct stats *s)
+{
+    if (s->n == 0)
+        return;
+    qsort(s->v, s->n, sizeof(double), cmp_double);
+    double sum = 0;
+    for (size_t i = 0; i < s->n; ++i)
+        sum += s->v[i];
+    printf("%-30s %7zu %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n", s->name, s->n,
+           s->v[0], sum / s->n, s->v[s->n / 2], s->v[s->n * 9 / 10], s->v[s->n * 99 / 100], s->v[s->n - 1]);
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: avr-bench [-m mcu] [-f hz] [-x us] [-c ms] [-v] main.elf main.sym script\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *mmcu = "atmega328p";
+    double tolerance_us = 500, cancel_ms = 10;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:f:x:c:v")) != -1) {
+        switch (opt) {
+        case 'm': mmcu = optarg; break;
+        case 'f': freq = strtoul(optarg, NULL, 0); break;
+        case 'x': tolerance_us = atof(optarg); break;
+        case 'c': cancel_ms = atof(optarg); break;
+        case 'v': verbose = 1; break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 3)
+        usage();
+
+    load_symbols(argv[optind + 1]);
+    load_script(argv[optind + 2]);
+
+    elf_firmware_t fw;
+    memset(&fw, 0, sizeof(fw));
+    if (elf_read_firmware(argv[optind], &fw) != 0) {
+        fprintf(stderr, "avr-bench: can't load %s\n", argv[optind]);
+        return 2;
+    }
+    avr = avr_make_mcu_by_name(mmcu);
+    if (!avr) {
+        fprintf(stderr, "avr-bench: simavr doesn't know '%s'\n", mmcu);
+        return 2;
+    }
+    avr_init(avr);
+    fw.frequency = freq;
+    avr_load_firmware(avr, &fw);
+
+    // inputs idle high: buttons released, encoder resting with both contacts open
+    for (int i = 0; i < 5; ++i) {
+        pinc[i] = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), i);
+        avr_raise_irq(pinc[i], 1);
+    }
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 5),
+                            shutter_edge, (void *)(uintptr_t)LINE_FULL);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), 5),
+                            shutter_edge, (void *)(uintptr_t)LINE_HALF);
+    if (num_events)
+        avr_cycle_timer_register(avr, events[0].at, script_tick, NULL);
+
+    uint8_t *display = &avr->data[symbols[SYM_DISPLAY].addr];
+    uint8_t shown[5];
+    memcpy(shown, display, sizeof(shown));
+    while (avr->cycle < end_at) {
+        int state = avr_run(avr);
+        if (state == cpu_Done || state == cpu_Crashed)
+            break;
+        if (memcmp(shown, display, sizeof(shown))) {
+            memcpy(shown, display, sizeof(shown));
+            display_changed(avr->cycle);
+        }
+    }
+
+    uint64_t tolerance = (uint64_t)(tolerance_us * freq / 1e6);
+    uint64_t cancel_limit = (uint64_t)(cancel_ms * freq / 1e3);
+    for (size_t i = 0; i < num_edges;)
+        i = check_sequence(i, tolerance, cancel_limit);
+
+    printf("\n%.1f s at %u Hz, %zu shutter edges\n\n", (double)avr->cycle / freq, freq, num_edges);
+    printf("%-30s %7s %9s %9s %9s %9s %9s %9s\n", "", "n", "min", "mean", "p50", "p90", "p99", "max");
+    report(&exposure_error);
+    report(&dead_time);
+    report(&dead_error);
+    report(&edge_error);
+    report(&start_latency);
+    report(&cancel_latency);
+    struct stats ui = { "input to display (ms)", latencies, num_latencies, cap_latencies };
+    report(&ui);
+    if (failures)
+        printf("\n%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,93 @@
+// Generates stop_tables.h (into build/gen): the exposure/delay stop scales the knob steps through,
+// in clock ticks (1/8 s), for PROGMEM. Run by the Makefile; see stops.h.
+//
+//   std     the original hand-picked scale
+//   half    1/2-stop progression from 1/8 s, as far as it goes within 90 min
+//           (68.5 min)
+//   third   1/3-stop progression, the same (86 min)
+//   linear  every 5 s up to 10 min, for flats and darks
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "../clock.h"
+
+#define T(secs) ((secs) * CLOCK_TICKS_PER_SEC)
+#define MAX_SECS 5400
+// stop indexes are int8_t, with -1 for "between stops"
+#define MAX_STOPS 127
+
+static const unsigned std[] = {
+    0, 1, 2, 4, T(1), T(2), T(3), T(4), T(5), T(6), T(8), T(10), T(13), T(15), T(20), T(25), T(30),
+    T(35), T(40), T(45), T(50), T(60), T(75), T(90), T(120), T(150), T(180), T(210), T(240), T(300),
+    T(360), T(480), T(540), T(600), T(720), T(900), T(1200), T(1500), T(1800), T(2100), T(2400),
+    T(2700), T(3000), T(3300), T(3600), T(4500), T(5400)
+};
+
+static unsigned table[MAX_STOPS];
+static int size;
+
+static void add(unsigned ticks)
+{
+    if (size && ticks <= table[size - 1])
+        return;
+    if (size == MAX_STOPS) {
+        fprintf(stderr, "gen-stops: more than %d stops\n", MAX_STOPS);
+        exit(1);
+    }
+    table[size++] = ticks;
+}
+
+// round to what the display shows sensibly: 1/8 s under 10 s, whole seconds under
+// 100 s, then 5 s, and 30 s from 10 min
+static unsigned nice(double secs)
+{
+    double grid = secs < 10 ? 1.0 / CLOCK_TICKS_PER_SEC : secs < 100 ? 1 : secs < 600 ? 5 : 30;
+    return (unsigned)(floor(secs / grid + 0.5) * grid * CLOCK_TICKS_PER_SEC + 0.5);
+}
+
+static void progression(int per_stop)
+{
+    add(0);
+    for (int k = 0; ; ++k) {
+        double secs = pow(2, (double)k / per_stop) / CLOCK_TICKS_PER_SEC;
+        if (secs > MAX_SECS * 1.001)
+            break;
+        add(nice(secs));
+    }
+}
+
+static void emit(const char *name)
+{
+    printf("static const uint16_t stops_%s[%d] PROGMEM = {", name, size);
+    for (int i = 0; i < size; ++i)
+        printf("%s%u", i == 0 ? "\n    " : (i % 12) ? ", " : ",\n    ", table[i]);
+    printf("\n};\n\n");
+    size = 0;
+}
+
+int main()
+{
+    printf("// generated by host/gen-stops.c; don't edit\n\n");
+
+    for (unsigned i = 0; i < sizeof(std) / sizeof(std[0]); ++i)
+        add(std[i]);
+    emit("std");
+
+    progression(2);
+    emit("half");
+
+    progression(3);
+    emit("third");
+
+    for (unsigned s = 0; s <= 600; s += 5)
+        add(T(s));
+    emit("linear");
+
+    printf("#define STOP_TABLE(name) { stops_##name, sizeof(stops_##name) / sizeof(stops_##name[0]) }\n");
+    printf("static const struct stop_table stop_tables[STOP_SCALES] PROGMEM = {\n");
+    printf("    STOP_TABLE(std), STOP_TABLE(half), STOP_TABLE(third), STOP_TABLE(linear)\n};\n");
+    return 0;
+}
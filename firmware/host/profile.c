@@ -0,0 +1,387 @@
+// Cycle-cost profiler for the AVR build, running main.elf under simavr
+//
+// Steps the simulated CPU one instruction at a time and keeps a shadow call stack:
+// an ISR frame starts when the PC lands in the vector table, a helper frame when it
+// lands on the first instruction of a profiled function, and either ends when the
+// stack pointer rises above where it was on entry (RET/RETI). Each frame's cost is
+// counted excluding any interrupts that preempt it, and split into prologue (the
+// leading push/in/clr r1 run, plus the 4-cycle interrupt response for ISRs), body and
+// epilogue (the trailing pop/out/ret run).
+//
+// usage: avr-profile [options] main.elf main.sym
+//   main.sym is `avr-nm main.elf` output, used to find the profiled functions
+//   -m mcu        simavr core name (default atmega328p)
+//   -f hz         CPU clock (default 2000000)
+//   -t seconds    virtual run time (default 10)
+//   -e rate       encoder detents per second (default 5, 0 = leave the knob alone)
+//   -b edges      contact bounce edges per encoder transition (default 2)
+//   -r            press Start after half a second, so the exposure sequence runs
+//   -p name       also profile this function (the render helpers are always profiled)
+//   -B name=max   fail if a frame's worst case exceeds max cycles
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_cycle_timers.h>
+#include <simavr/avr_ioport.h>
+
+#define ISR_RESPONSE 4
+
+static const char *vector_names[] = {
+    "RESET", "INT0_vect", "INT1_vect", "PCINT0_vect", "PCINT1_vect", "PCINT2_vect",
+    "WDT_vect", "TIMER2_COMPA_vect", "TIMER2_COMPB_vect", "TIMER2_OVF_vect",
+    "TIMER1_CAPT_vect", "TIMER1_COMPA_vect", "TIMER1_COMPB_vect", "TIMER1_OVF_vect",
+    "TIMER0_COMPA_vect", "TIMER0_COMPB_vect", "TIMER0_OVF_vect", "SPI_STC_vect",
+    "USART_RX_vect", "USART_UDRE_vect", "USART_TX_vect", "ADC_vect", "EE_READY_vect",
+    "ANALOG_COMP_vect", "TWI_vect", "SPM_READY_vect",
+};
+#define NUM_VECTORS (sizeof(vector_names) / sizeof(vector_names[0]))
+
+static const char *default_helpers[] = {
+    "DisplayNum", "DisplayAlnum", "Display3", "display_commit",
+};
+
+struct stats {
+    const char *name;
+    uint32_t addr;          // helpers only
+    uint32_t budget;
+    uint64_t calls, total, min, max;
+    uint64_t prologue, epilogue;
+};
+
+static struct stats isr_stats[NUM_VECTORS];
+static struct stats helper_stats[32];
+static int num_helpers;
+
+struct frame {
+    struct stats *st;
+    uint16_t sp;
+    uint8_t isr;
+    uint8_t in_prologue;
+    uint64_t cost, prologue, epilogue_run;
+};
+
+static struct frame stack[64];
+static int depth;
+
+static uint16_t get_sp(avr_t *avr)
+{
+    return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+}
+
+static uint16_t opcode_at(avr_t *avr, avr_flashaddr_t pc)
+{
+    return avr->flash[pc] | (avr->flash[pc + 1] << 8);
+}
+
+static int is_prologue_op(uint16_t op)
+{
+    return (op & 0xFE0F) == 0x920F      // push
+        || (op & 0xF800) == 0xB000      // in
+        || op == 0x2411;                // clr r1
+}
+
+static int is_epilogue_op(uint16_t op)
+{
+    return (op & 0xFE0F) == 0x900F      // pop
+        || (op & 0xF800) == 0xB800      // out
+        || op == 0x9508 || op == 0x9518; // ret, reti
+}
+
+static void push_frame(struct stats *st, uint16_t sp, uint8_t isr)
+{
+    if (depth == sizeof(stack) / sizeof(stack[0])) {
+        fprintf(stderr, "avr-profile: shadow stack overflow\n");
+        exit(2);
+    }
+    struct frame *f = &stack[depth++];
+    memset(f, 0, sizeof(*f));
+    f->st = st;
+    f->sp = sp;
+    f->isr = isr;
+    f->in_prologue = 1;
+    if (isr) {
+        f->cost = ISR_RESPONSE;
+        f->prologue = ISR_RESPONSE;
+    }
+}
+
+static void pop_frame()
+{
+    struct frame *f = &stack[--depth];
+    struct stats *st = f->st;
+    if (st->calls == 0 || f->cost < st->min)
+        st->min = f->cost;
+    if (f->cost > st->max)
+        st->max = f->cost;
+    ++st->calls;
+    st->total += f->cost;
+    st->prologue += f->prologue;
+    st->epilogue += f->epilogue_run;
+}
+
+// charge an executed instruction to the running frame and its callers, up to
+// and including the innermost ISR
+static void charge(uint16_t op, uint64_t cycles)
+{
+    for (int i = depth - 1; i >= 0; --i) {
+        struct frame *f = &stack[i];
+        f->cost += cycles;
+        if (i == depth - 1) {
+            if (f->in_prologue && is_prologue_op(op))
+                f->prologue += cycles;
+            else
+                f->in_prologue = 0;
+            f->epilogue_run = is_epilogue_op(op) ? f->epilogue_run + cycles : 0;
+        }
+        if (f->isr)
+            break;
+    }
+}
+
+// -- workload
+
+static avr_irq_t *pinc[5];
+static avr_cycle_count_t encoder_period, bounce_period;
+static int bounce_edges;
+static uint8_t enc_state = 0b11, enc_step, enc_bounce;
+
+static avr_cycle_count_t encoder_tick(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+    static const uint8_t cw[4] = { 0b10, 0b00, 0b01, 0b11 };
+    uint8_t target = cw[enc_step];
+    uint8_t changing = enc_state ^ target;
+
+    if (enc_bounce < bounce_edges) {
+        // chatter on the changing contact before it settles
+        uint8_t pin = (changing & 1) ? 0 : 1;
+        uint8_t settled = (target >> pin) & 1;
+        avr_raise_irq(pinc[pin], (enc_bounce & 1) ? !settled : settled);
+        ++enc_bounce;
+        return when + bounce_period;
+    }
+    enc_bounce = 0;
+    avr_raise_irq(pinc[0], target & 1);
+    avr_raise_irq(pinc[1], (target >> 1) & 1);
+    enc_state = target;
+    enc_step = (enc_step + 1) & 3;
+    // four transitions per detent
+    return when + (enc_step ? encoder_period / 16 : encoder_period - 3 * (encoder_period / 16));
+}
+
+static avr_cycle_count_t start_down(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+    avr_raise_irq(pinc[2], 0);
+    return 0;
+}
+
+static avr_cycle_count_t start_up(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+    avr_raise_irq(pinc[2], 1);
+    return 0;
+}
+
+// -- symbols
+
+static void load_symbols(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    char line[256], name[200], type;
+    unsigned addr;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%x %c %199s", &addr, &type, name) != 3)
+            continue;
+        for (int i = 0; i < num_helpers; ++i)
+            if (!strcmp(helper_stats[i].name, name))
+                helper_stats[i].addr = addr;
+    }
+    fclose(f);
+}
+
+static void add_helper(const char *name)
+{
+    if (num_helpers == sizeof(helper_stats) / sizeof(helper_stats[0]))
+        return;
+    helper_stats[num_helpers].name = name;
+    helper_stats[num_helpers].addr = UINT32_MAX;
+    ++num_helpers;
+}
+
+static struct stats *find_stats(const char *name)
+{
+    for (size_t i = 0; i < NUM_VECTORS; ++i)
+        if (!strcmp(isr_stats[i].name, name))
+            return &isr_stats[i];
+    for (int i = 0; i < num_helpers; ++i)
+        if (!strcmp(helper_stats[i].name, name))
+            return &helper_stats[i];
+    return NULL;
+}
+
+static int report(struct stats *st, uint64_t run_cycles)
+{
+    if (st->calls == 0)
+        return 0;
+    printf("%-20s %9llu %6llu %8.1f %6llu %9.1f %9.1f %7.3f%%",
+           st->name, (unsigned long long)st->calls,
+           (unsigned long long)st->min, (double)st->total / st->calls, (unsigned long long)st->max,
+           (double)st->prologue / st->calls, (double)st->epilogue / st->calls,
+           100.0 * st->total / run_cycles);
+    if (st->budget && st->max > st->budget) {
+        printf("  OVER BUDGET (%u)\n", st->budget);
+        return 1;
+    }
+    if (st->budget)
+        printf("  (budget %u)", st->budget);
+    printf("\n");
+    return 0;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: avr-profile [-m mcu] [-f hz] [-t seconds] [-e rate] [-b edges] [-r]\n"
+                    "                   [-p function] [-B name=max] main.elf main.sym\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *mmcu = "atmega328p";
+    uint32_t freq = 2000000;
+    double run_secs = 10, enc_rate = 5;
+    int press_start = 0;
+    const char *budgets[32];
+    int num_budgets = 0;
+
+    for (size_t i = 0; i < sizeof(default_helpers) / sizeof(default_helpers[0]); ++i)
+        add_helper(default_helpers[i]);
+    for (size_t i = 0; i < NUM_VECTORS; ++i)
+        isr_stats[i].name = vector_names[i];
+
+    int opt;
+    bounce_edges = 2;
+    while ((opt = getopt(argc, argv, "m:f:t:e:b:rp:B:")) != -1) {
+        switch (opt) {
+        case 'm': mmcu = optarg; break;
+        case 'f': freq = strtoul(optarg, NULL, 0); break;
+        case 't': run_secs = atof(optarg); break;
+        case 'e': enc_rate = atof(optarg); break;
+        case 'b': bounce_edges = atoi(optarg); break;
+        case 'r': press_start = 1; break;
+        case 'p': add_helper(optarg); break;
+        case 'B':
+            if (num_budgets < 32)
+                budgets[num_budgets++] = optarg;
+            break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 2)
+        usage();
+
+    load_symbols(argv[optind + 1]);
+    for (int i = 0; i < num_budgets; ++i) {
+        char name[64];
+        unsigned max;
+        struct stats *st = NULL;
+        if (sscanf(budgets[i], "%63[^=]=%u", name, &max) == 2)
+            st = find_stats(name);
+        if (!st) {
+            fprintf(stderr, "avr-profile: bad budget '%s'\n", budgets[i]);
+            return 2;
+        }
+        st->budget = max;
+    }
+
+    elf_firmware_t fw;
+    memset(&fw, 0, sizeof(fw));
+    if (elf_read_firmware(argv[optind], &fw) != 0) {
+        fprintf(stderr, "avr-profile: can't load %s\n", argv[optind]);
+        return 2;
+    }
+    avr_t *avr = avr_make_mcu_by_name(mmcu);
+    if (!avr) {
+        fprintf(stderr, "avr-profile: simavr doesn't know '%s'\n", mmcu);
+        return 2;
+    }
+    avr_init(avr);
+    fw.frequency = freq;
+    avr_load_firmware(avr, &fw);
+
+    // inputs idle high: buttons released, encoder resting with both contacts open
+    for (int i = 0; i < 5; ++i) {
+        pinc[i] = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), i);
+        avr_raise_irq(pinc[i], 1);
+    }
+    if (enc_rate > 0) {
+        encoder_period = (avr_cycle_count_t)(freq / enc_rate);
+        bounce_period = freq / 20000;   // 50us between bounce edges
+        avr_cycle_timer_register(avr, freq / 4, encoder_tick, NULL);
+    }
+    if (press_start) {
+        avr_cycle_timer_register(avr, freq / 2, start_down, NULL);
+        avr_cycle_timer_register(avr, freq / 2 + freq / 10, start_up, NULL);
+    }
+
+    uint32_t vector_bytes = avr->vector_size * NUM_VECTORS;
+    avr_cycle_count_t end = (avr_cycle_count_t)(run_secs * freq);
+    uint64_t awake = 0;
+
+    while (avr->cycle < end) {
+        avr_cycle_count_t before = avr->cycle;
+        uint8_t was_running = (avr->state == cpu_Running);
+        uint16_t op = opcode_at(avr, avr->pc);
+
+        int state = avr_run(avr);
+        if (state == cpu_Done || state == cpu_Crashed)
+            break;
+
+        uint64_t cycles = avr->cycle - before;
+        avr_flashaddr_t pc = avr->pc;
+        uint16_t sp = get_sp(avr);
+        uint8_t entered_isr = pc > 0 && pc < vector_bytes && (pc % avr->vector_size) == 0;
+
+        if (was_running) {
+            uint64_t own = entered_isr && cycles > ISR_RESPONSE ? cycles - ISR_RESPONSE : cycles;
+            awake += cycles;
+            charge(op, own);
+        }
+        while (depth > 0 && sp > stack[depth - 1].sp)
+            pop_frame();
+
+        if (entered_isr) {
+            push_frame(&isr_stats[pc / avr->vector_size], sp, 1);
+        } else {
+            for (int i = 0; i < num_helpers; ++i) {
+                if (helper_stats[i].addr == pc) {
+                    push_frame(&helper_stats[i], sp, 0);
+                    break;
+                }
+            }
+        }
+    }
+
+    uint64_t run_cycles = avr->cycle;
+    printf("%.1f s at %u Hz: %llu cycles, %.2f%% awake\n\n", run_cycles / (double)freq, freq,
+           (unsigned long long)run_cycles, 100.0 * awake / run_cycles);
+    printf("%-20s %9s %6s %8s %6s %9s %9s %8s\n",
+           "cycles per call", "calls", "min", "avg", "max", "prologue", "epilogue", "share");
+    int over = 0;
+    for (size_t i = 0; i < NUM_VECTORS; ++i)
+        over += report(&isr_stats[i], run_cycles);
+    for (int i = 0; i < num_helpers; ++i) {
+        if (helper_stats[i].addr == UINT32_MAX)
+            printf("%-20s (not in main.sym; inlined?)\n", helper_stats[i].name);
+        else
+            over += report(&helper_stats[i], run_cycles);
+    }
+    return over ? 1 : 0;
+}
@@ -0,0 +1,1160 @@
+// Host simulator for the astro-timer firmware
+//
+// The firmware is compiled unmodified against the stand-in AVR headers in this
+// directory. Registers become plain variables, and every call the firmware makes
+// into the "hardware" (sleep, sei, _delay_ms, reading PINC) lets the simulator run
+// its virtual clock forward, advancing Timer0/1/2, the ADC and the EEPROM and
+// calling the firmware's ISRs when their interrupts fire. Nothing is tied to
+// wall-clock time, so a night-long exposure sequence runs in seconds.
+//
+// Input comes from a script (see scripts/), and full- and half-press shutter
+// edges are logged with their virtual timestamps. Script lines are
+// "<time> <command> [args]", where time is in virtual seconds (m/h/u suffixes
+// allowed), or relative to the previous line with a leading '+':
+//   press <buttons> [hold]   press and release (buttons: start, select, set; join with '+')
+//   down/up <buttons>        change button state
+//   turn <detents> [ms]      turn the encoder (negative = counter-clockwise), one
+//                            detent every ms milliseconds (default 30)
+//   chatter <ms>             the encoder's A contact bounces for ms milliseconds
+//   vcc <volts>, temp <C>    what the ADC sees
+//   show                     log the display contents
+//   expect pulses <n>        fail unless n full-press pulses have completed
+//   expect display <text>    fail unless the display reads text ('_' = blank digit)
+//   send <hex>               bytes arriving on the USART, e.g. 7e0110d7
+//   end                      stop and print a summary (with the time spent in
+//                            each sleep mode, and how often the CPU woke from it)
+//
+// Bytes the firmware sends on the USART are logged. With -p, the USART is
+// bridged to a pseudo-terminal instead, and virtual time is paced to the wall
+// clock, so a host program (e.g. astro-remote) can talk to the firmware.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include "../display.h"
+
+#define SIM_REG8(r)  volatile uint8_t r;
+#define SIM_REG16(r) volatile uint16_t r;
+#include "sim_regs.h"
+#undef SIM_REG8
+#undef SIM_REG16
+
+int firmware_main(void);
+
+// -- virtual time
+// one unit is 1/512,000,000 s, which divides evenly into both a cycle of the
+// 8MHz RC oscillator (64 units) and a tick of the 32.768kHz crystal (15625 units)
+
+#define UNITS_PER_SEC 512000000ULL
+#define XTAL_UNITS    15625ULL
+#define NEVER         UINT64_MAX
+
+static uint64_t now;
+static uint8_t sleeping;
+
+// time spent in each sleep mode (by SM2..0), and the interrupts that woke the CPU from it
+static uint64_t slept[8];
+static uint32_t wakeups[8];
+
+static uint64_t cpu_units()
+{
+    uint8_t clkps = CLKPR & 0x0F;
+    return 64ULL << (clkps > 8 ? 8 : clkps);
+}
+
+static double seconds(uint64_t t)
+{
+    return (double)t / UNITS_PER_SEC;
+}
+
+// clkIO is halted in every sleep mode except idle;
+// the asynchronous timer keeps running in idle, ADC noise reduction, power-save
+// and extended standby
+static uint8_t sleep_mode_bits()
+{
+    return (SMCR >> SM0) & 7;
+}
+
+static uint8_t clkio_running()
+{
+    return !sleeping || sleep_mode_bits() == 0;
+}
+
+static uint8_t async_running()
+{
+    uint8_t sm = sleep_mode_bits();
+    return !sleeping || sm == 0 || sm == 1 || sm == 3 || sm == 7;
+}
+
+// -- timers
+// each timer is kept as "the counter was at count0 at time origin", plus the time and
+// effect of its next compare match or overflow; TCNTn is only brought up to date when
+// control returns to the firmware
+
+struct timer {
+    volatile uint8_t *tccra, *tccrb;
+    volatile uint8_t *tcnt8, *ocra8, *ocrb8;
+    volatile uint16_t *tcnt16, *ocra16, *ocrb16;
+    volatile uint8_t *tifr;
+    uint8_t prr_bit;
+    uint8_t wgm12;      // timer1 selects CTC mode in TCCR1B rather than TCCRnA
+    uint16_t max;
+    uint8_t async;      // timer2 may be clocked from the crystal
+
+    // configuration as of the last sync
+    uint64_t tu;        // units per tick, 0 if stopped
+    uint16_t top, ocra, ocrb;
+    uint8_t ctc;
+
+    uint16_t count0;
+    uint64_t origin;
+    uint16_t shadow;    // last value we stored into TCNTn
+
+    uint64_t next_at;
+    uint16_t next_count;
+    uint8_t next_flags;
+    uint8_t pending;    // interrupt flags not yet serviced
+};
+
+static struct timer timers[3] = {
+    { &TCCR0A, &TCCR0B, &TCNT0, &OCR0A, &OCR0B, 0, 0, 0, &TIFR0, PRTIM0, 0, 0xFF, 0 },
+    { &TCCR1A, &TCCR1B, 0, 0, 0, &TCNT1, &OCR1A, &OCR1B, &TIFR1, PRTIM1, 1, 0xFFFF, 0 },
+    { &TCCR2A, &TCCR2B, &TCNT2, &OCR2A, &OCR2B, 0, 0, 0, &TIFR2, PRTIM2, 0, 0xFF, 1 },
+};
+
+static uint16_t reg16(volatile uint8_t *r8, volatile uint16_t *r16)
+{
+    return r8 ? *r8 : *r16;
+}
+
+// units per timer tick, or 0 if the timer isn't counting
+static uint64_t tick_units(struct timer *t)
+{
+    static const uint16_t sync_presc[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+    static const uint16_t async_presc[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+
+    if (PRR & _BV(t->prr_bit))
+        return 0;
+    uint8_t cs = *t->tccrb & 7;
+    if (t->async) {
+        if (async_presc[cs] == 0)
+            return 0;
+        if (ASSR & _BV(AS2))
+            return async_running() ? XTAL_UNITS * async_presc[cs] : 0;
+        return clkio_running() ? cpu_units() * async_presc[cs] : 0;
+    }
+    if (sync_presc[cs] == 0 || !clkio_running())
+        return 0;
+    return cpu_units() * sync_presc[cs];
+}
+
+static uint32_t ticks_to_zero(struct timer *t, uint16_t from)
+{
+    return (from <= t->top) ? (uint32_t)t->top - from + 1 : (uint32_t)t->max - from + 1;
+}
+
+// counter value `ticks` ticks after it was at `from`
+static uint16_t step(struct timer *t, uint16_t from, uint64_t ticks)
+{
+    uint32_t z = ticks_to_zero(t, from);
+    if (ticks < z)
+        return from + ticks;
+    return (ticks - z) % ((uint32_t)t->top + 1);
+}
+
+// ticks until the counter next becomes v (0 if it never will)
+static uint32_t ticks_until(struct timer *t, uint16_t v)
+{
+    if (v > t->count0 && (v <= t->top || t->count0 > t->top))
+        return v - t->count0;
+    if (v > t->top)
+        return 0;
+    return ticks_to_zero(t, t->count0) + v;
+}
+
+static void schedule(struct timer *t)
+{
+    t->next_at = NEVER;
+    if (t->tu == 0)
+        return;
+
+    uint32_t d[3] = {
+        ticks_until(t, t->ocra),
+        ticks_until(t, t->ocrb),
+        (t->ctc && t->count0 <= t->top) ? 0 : (uint32_t)t->max - t->count0 + 1,
+    };
+    static const uint8_t flag[3] = { _BV(OCF0A), _BV(OCF0B), _BV(TOV0) };
+    uint32_t best = 0;
+    for (int i = 0; i < 3; ++i)
+        if (d[i] && (best == 0 || d[i] < best))
+            best = d[i];
+    if (best == 0)
+        return;
+    t->next_flags = 0;
+    for (int i = 0; i < 3; ++i)
+        if (d[i] == best)
+            t->next_flags |= flag[i];
+    t->next_at = t->origin + best * t->tu;
+    t->next_count = step(t, t->count0, best);
+}
+
+static uint64_t ticks_since_origin(struct timer *t)
+{
+    uint64_t elapsed = now - t->origin;
+    if (elapsed < t->tu)
+        return 0;
+    return elapsed / t->tu;
+}
+
+static uint16_t count_now(struct timer *t)
+{
+    if (t->tu == 0)
+        return t->count0;
+    return step(t, t->count0, ticks_since_origin(t));
+}
+
+// the firmware may have written TCNTn, OCRnx or the clock select since we last looked
+static void timer_sync(struct timer *t)
+{
+    uint64_t tu = tick_units(t);
+    uint8_t ctc = t->wgm12 ? (*t->tccrb & _BV(WGM12)) != 0 : (*t->tccra & _BV(WGM01)) != 0;
+    uint16_t ocra = reg16(t->ocra8, t->ocra16);
+    uint16_t ocrb = reg16(t->ocrb8, t->ocrb16);
+    uint16_t tcnt = reg16(t->tcnt8, t->tcnt16);
+
+    if (tu == t->tu && ctc == t->ctc && ocra == t->ocra && ocrb == t->ocrb && tcnt == t->shadow)
+        return;
+
+    uint64_t phase = 0;
+    if (tcnt != t->shadow) {
+        t->count0 = tcnt;
+    } else {
+        if (t->tu && tu == t->tu)
+            phase = now - t->origin - ticks_since_origin(t) * t->tu;
+        t->count0 = count_now(t);
+    }
+    t->origin = now - phase;
+    t->shadow = tcnt;
+    t->tu = tu;
+    t->ctc = ctc;
+    t->ocra = ocra;
+    t->ocrb = ocrb;
+    t->top = ctc ? ocra : t->max;
+    schedule(t);
+}
+
+static uint64_t published_at = NEVER;
+
+static void timer_fire(struct timer *t)
+{
+    published_at = NEVER;
+    t->pending |= t->next_flags;
+    t->count0 = t->next_count;
+    t->origin = t->next_at;
+    schedule(t);
+}
+
+// bring TCNTn up to date for the firmware
+static void timer_publish(struct timer *t)
+{
+    uint16_t c = count_now(t);
+    if (t->tcnt8)
+        *t->tcnt8 = (uint8_t)c;
+    else
+        *t->tcnt16 = c;
+    t->shadow = c;
+}
+
+// -- pin-change inputs
+// PC0..PC4 idle high (pull-ups; the encoder rests with both contacts open)
+
+static uint8_t pinc_in = 0x1F;
+static uint8_t pcint_pending;
+
+uint8_t sim_read_pinc(void)
+{
+    // reading the inputs costs a few cycles, so busy-waits on a button make progress
+    sim_delay_cycles(4);
+    return (pinc_in & ~DDRC) | (PORTC & DDRC);
+}
+
+static void set_pinc(uint8_t mask, uint8_t level)
+{
+    uint8_t old = pinc_in;
+    pinc_in = level ? (pinc_in | mask) : (pinc_in & ~mask);
+    if ((old ^ pinc_in) & PCMSK1 & ~DDRC)
+        pcint_pending |= _BV(PCIF1);
+}
+
+// -- ADC
+// battery voltage and die temperature are script-controlled; conversions get a
+// little deterministic noise so filtering has something to do
+
+static double vcc = 3.0;
+static double temperature = 20.0;
+static uint8_t adc_busy, adc_first = 1, adc_pending;
+static uint64_t adc_done;
+static uint32_t noise_seed = 12345;
+
+static uint16_t adc_value()
+{
+    double ref = (ADMUX & _BV(REFS1)) ? 1.1 : vcc;
+    double v;
+    switch (ADMUX & 0x0F) {
+    case 0x0E: v = 1.1; break;                                  // bandgap
+    case 0x08: v = 0.314 + (temperature - 25.0) * 0.00094; break; // temperature sensor
+    default:   v = 0; break;
+    }
+    noise_seed = noise_seed * 1103515245 + 12345;
+    int noise = (int)((noise_seed >> 16) % 5) - 2;
+    int adc = (int)(v * 1024 / ref + 0.5) + noise;
+    return adc < 0 ? 0 : adc > 1023 ? 1023 : adc;
+}
+
+static void adc_start()
+{
+    static const uint8_t presc[8] = { 2, 2, 4, 8, 16, 32, 64, 128 };
+    adc_busy = 1;
+    adc_done = now + cpu_units() * presc[ADCSRA & 7] * (adc_first ? 25 : 13);
+    adc_first = 0;
+}
+
+static void adc_sync()
+{
+    if (!(ADCSRA & _BV(ADEN)) || (PRR & _BV(PRADC))) {
+        adc_busy = 0;
+        adc_first = 1;
+        ADCSRA &= ~_BV(ADSC);
+        return;
+    }
+    if ((ADCSRA & _BV(ADSC)) && !adc_busy) {
+        // sample_adc() clears ADIF (by writing 1) right before starting the next conversion
+        adc_pending = 0;
+        adc_start();
+    }
+    if (adc_pending)
+        ADCSRA |= _BV(ADIF);
+    else
+        ADCSRA &= ~_BV(ADIF);
+}
+
+static void adc_finish()
+{
+    adc_busy = 0;
+    ADCW = adc_value();
+    ADCSRA &= ~_BV(ADSC);
+    adc_pending = 1;
+    ADCSRA |= _BV(ADIF);
+}
+
+// -- EEPROM
+// 3.4ms per byte write, during which the EEPROM is busy
+
+#define EE_WRITE_UNITS (UNITS_PER_SEC * 34 / 10000)
+
+static uint8_t eeprom[E2END + 1];
+static const char *eeprom_file;
+static uint8_t eedr;
+static uint8_t ee_busy;
+static uint64_t ee_done;
+
+static void ee_write(uint16_t addr, uint8_t value)
+{
+    eeprom[addr & E2END] = value;
+    ee_busy = 1;
+    ee_done = now + EE_WRITE_UNITS;
+    EECR |= _BV(EEPE);
+}
+
+volatile uint8_t *sim_eedr(void)
+{
+    if (EECR & _BV(EERE)) {
+        EECR &= ~_BV(EERE);
+        eedr = eeprom[EEAR & E2END];
+    }
+    return &eedr;
+}
+
+static void ee_sync()
+{
+    // the firmware started a write through EECR
+    if ((EECR & _BV(EEPE)) && !ee_busy) {
+        EECR &= ~_BV(EEMPE);
+        ee_write(EEAR, eedr);
+    }
+}
+
+static void ee_wait()
+{
+    while (ee_busy)
+        sim_delay_cycles(16);
+}
+
+uint8_t eeprom_read_byte(const uint8_t *addr)
+{
+    ee_wait();
+    return eeprom[(uintptr_t)addr & E2END];
+}
+
+void eeprom_write_byte(uint8_t *addr, uint8_t value)
+{
+    ee_wait();
+    ee_write((uintptr_t)addr, value);
+}
+
+void eeprom_update_byte(uint8_t *addr, uint8_t value)
+{
+    if (eeprom_read_byte(addr) != value)
+        eeprom_write_byte(addr, value);
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        ((uint8_t *)dst)[i] = eeprom_read_byte((const uint8_t *)src + i);
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        eeprom_update_byte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+}
+
+uint8_t sim_signature_byte(uint8_t addr)
+{
+    // ATmega328P signature row
+    static const uint8_t sig[32] = {
+        0x1E, 0x9B, 0x95, 0xFF, 0x0F, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x54, 0xFF,
+        0x50, 0x35, 0x38, 0x32, 0x34, 0x34, 0x31, 0x14,
+        0x13, 0x0E, 0x0A, 0x0A, 0x15, 0x13, 0x1F, 0x0F,
+    };
+    return sig[addr & 0x1F];
+}
+
+// -- USART
+// Bytes take ten bit times. A byte written to UDR0 moves straight to the shift
+// register if it's idle, else waits in the transmit buffer (UDRE clear).
+// The simulator keeps 0x100 | <last byte received> in the 16-bit UDR0, so
+// anything below 0x100 there is a byte the firmware wrote.
+
+static uint8_t usart_rx_pending;    // RXC; cleared when the vector executes
+static uint8_t udre_level;          // UDRE and TXEN; level-triggered
+static uint8_t last_rx;
+static int tx_buffered = -1;
+static uint64_t tx_done = NEVER;    // shift register busy until
+static uint8_t rx_queue[256];
+static uint8_t rx_head, rx_tail;
+static uint64_t rx_next = NEVER;    // the next queued byte has arrived
+
+static uint8_t quiet;
+static int pty_fd = -1;
+
+static uint64_t usart_byte_units()
+{
+    uint64_t div = (UCSR0A & _BV(U2X0)) ? 8 : 16;
+    return cpu_units() * div * ((uint64_t)UBRR0 + 1) * 10;
+}
+
+static uint8_t usart_powered()
+{
+    return !(PRR & _BV(PRUSART0));
+}
+
+static void usart_emit(uint8_t b)
+{
+    if (pty_fd >= 0) {
+        if (write(pty_fd, &b, 1) != 1)
+            perror("uart pty");
+    } else if (!quiet) {
+        printf("%12.6f  uart tx %02x\n", seconds(now), b);
+    }
+}
+
+static void usart_queue(uint8_t b)
+{
+    rx_queue[rx_head++] = b;
+    if (rx_next == NEVER)
+        rx_next = now + usart_byte_units();
+}
+
+static void usart_sync()
+{
+    if (UDR0 < 0x100) {
+        uint8_t b = UDR0;
+        UDR0 = 0x100 | last_rx;
+        if (usart_powered() && (UCSR0B & _BV(TXEN0))) {
+            if (tx_done == NEVER) {
+                usart_emit(b);
+                tx_done = now + usart_byte_units();
+            } else {
+                tx_buffered = b;
+            }
+        }
+    }
+    if (!usart_powered() || !(UCSR0B & _BV(RXEN0)))
+        usart_rx_pending = 0;
+    UCSR0A = (UCSR0A & ~(_BV(RXC0) | _BV(UDRE0)))
+        | (usart_rx_pending ? _BV(RXC0) : 0) | (tx_buffered < 0 ? _BV(UDRE0) : 0);
+    udre_level = usart_powered() && (UCSR0B & _BV(TXEN0)) && tx_buffered < 0;
+}
+
+static void usart_tx_finish()
+{
+    if (tx_buffered >= 0) {
+        usart_emit(tx_buffered);
+        tx_buffered = -1;
+        tx_done += usart_byte_units();
+    } else {
+        tx_done = NEVER;
+        UCSR0A |= _BV(TXC0);
+    }
+}
+
+static void usart_rx_finish()
+{
+    uint8_t b = rx_queue[rx_tail++];
+    if (usart_powered() && (UCSR0B & _BV(RXEN0))) {
+        last_rx = b;
+        UDR0 = 0x100 | b;
+        usart_rx_pending = 1;
+    }
+    rx_next = (rx_head != rx_tail) ? rx_next + usart_byte_units() : NEVER;
+}
+
+// bridge the USART to a pseudo-terminal
+static void open_pty()
+{
+    pty_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty_fd < 0 || grantpt(pty_fd) || unlockpt(pty_fd)) {
+        perror("pty");
+        exit(2);
+    }
+    // hold the other end open in raw mode, so nothing is echoed before a
+    // host program connects, and reads don't fail between connections
+    int slave = open(ptsname(pty_fd), O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (slave < 0 || tcgetattr(slave, &tio)) {
+        perror("pty");
+        exit(2);
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    fcntl(pty_fd, F_SETFL, O_NONBLOCK);
+    fprintf(stderr, "uart: %s\n", ptsname(pty_fd));
+}
+
+// keep virtual time from running ahead of the wall clock, and pick up
+// whatever the host has sent
+static void pty_poll()
+{
+    static struct timespec start;
+    struct timespec t;
+    if (start.tv_sec == 0 && start.tv_nsec == 0)
+        clock_gettime(CLOCK_MONOTONIC, &start);
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    double ahead = seconds(now) - ((t.tv_sec - start.tv_sec) + (t.tv_nsec - start.tv_nsec) / 1e9);
+    if (ahead > 0) {
+        struct timespec d = { (time_t)ahead, (long)((ahead - (time_t)ahead) * 1e9) };
+        nanosleep(&d, NULL);
+    }
+    uint8_t buf[64];
+    ssize_t n = read(pty_fd, buf, sizeof(buf));
+    for (ssize_t i = 0; i < n; ++i)
+        usart_queue(buf[i]);
+}
+
+// -- interrupt vectors, in priority order
+
+#define VECTOR(v) void v(void) __attribute__((weak));
+VECTOR(PCINT1_vect)
+VECTOR(TIMER2_COMPA_vect) VECTOR(TIMER2_COMPB_vect) VECTOR(TIMER2_OVF_vect)
+VECTOR(TIMER1_COMPA_vect) VECTOR(TIMER1_COMPB_vect) VECTOR(TIMER1_OVF_vect)
+VECTOR(TIMER0_COMPA_vect) VECTOR(TIMER0_COMPB_vect) VECTOR(TIMER0_OVF_vect)
+VECTOR(USART_RX_vect) VECTOR(USART_UDRE_vect)
+VECTOR(ADC_vect) VECTOR(EE_READY_vect)
+#undef VECTOR
+
+struct vector {
+    void (*handler)(void);
+    uint8_t *pending;       // flag is cleared when the vector executes (0 = level-triggered)
+    uint8_t bit;
+    volatile uint8_t *enable_reg;
+    uint8_t enable_bit;
+    uint8_t wakes_from_deep_sleep;
+};
+
+static uint8_t ee_ready_level;
+
+static struct vector vectors[] = {
+    { PCINT1_vect,       &pcint_pending,      PCIF1, &PCICR,  PCIE1,  1 },
+    { TIMER2_COMPA_vect, &timers[2].pending,  OCF2A, &TIMSK2, OCIE2A, 1 },
+    { TIMER2_COMPB_vect, &timers[2].pending,  OCF2B, &TIMSK2, OCIE2B, 1 },
+    { TIMER2_OVF_vect,   &timers[2].pending,  TOV2,  &TIMSK2, TOIE2,  1 },
+    { TIMER1_COMPA_vect, &timers[1].pending,  OCF1A, &TIMSK1, OCIE1A, 0 },
+    { TIMER1_COMPB_vect, &timers[1].pending,  OCF1B, &TIMSK1, OCIE1B, 0 },
+    { TIMER1_OVF_vect,   &timers[1].pending,  TOV1,  &TIMSK1, TOIE1,  0 },
+    { TIMER0_COMPA_vect, &timers[0].pending,  OCF0A, &TIMSK0, OCIE0A, 0 },
+    { TIMER0_COMPB_vect, &timers[0].pending,  OCF0B, &TIMSK0, OCIE0B, 0 },
+    { TIMER0_OVF_vect,   &timers[0].pending,  TOV0,  &TIMSK0, TOIE0,  0 },
+    { USART_RX_vect,     &usart_rx_pending,   0,     &UCSR0B, RXCIE0, 0 },
+    { USART_UDRE_vect,   &udre_level,         0,     &UCSR0B, UDRIE0, 0 },
+    { ADC_vect,          &adc_pending,        0,     &ADCSRA, ADIE,   0 },
+    { EE_READY_vect,     &ee_ready_level,     0,     &EECR,   EERIE,  0 },
+};
+
+#define NUM_VECTORS (sizeof(vectors) / sizeof(vectors[0]))
+
+// -- shutter edge log
+
+static uint8_t last_full, last_half;
+static uint64_t full_on_at, half_on_at;
+static uint32_t full_pulses, half_pulses;
+static uint64_t full_total, full_shortest = NEVER, full_longest;
+
+static void watch_outputs()
+{
+    uint8_t full = (PORTB & DDRB & _BV(PB5)) != 0;
+    uint8_t half = (PORTC & DDRC & _BV(PC5)) != 0;
+
+    if (full != last_full) {
+        if (!quiet)
+            printf("%12.6f  full-press %s\n", seconds(now), full ? "on" : "off");
+        if (full) {
+            full_on_at = now;
+        } else {
+            uint64_t len = now - full_on_at;
+            ++full_pulses;
+            full_total += len;
+            if (len < full_shortest) full_shortest = len;
+            if (len > full_longest) full_longest = len;
+        }
+        last_full = full;
+    }
+    if (half != last_half) {
+        if (!quiet)
+            printf("%12.6f  half-press %s\n", seconds(now), half ? "on" : "off");
+        if (half)
+            half_on_at = now;
+        else
+            ++half_pulses;
+        last_half = half;
+    }
+}
+
+// -- script
+
+enum { EV_PINS, EV_SHOW, EV_EXPECT_PULSES, EV_EXPECT_DISPLAY, EV_VCC, EV_TEMP, EV_SEND, EV_END };
+
+struct event {
+    uint64_t at;
+    uint32_t seq;
+    uint8_t type;
+    uint8_t mask, level;
+    double value;
+    char text[8];
+    uint8_t data[32];
+    uint8_t len;
+};
+
+static struct event *events;
+static size_t num_events, cap_events, next_event_idx;
+static uint64_t end_at = NEVER;
+static int failures;
+
+static struct event *add_event(uint64_t at, uint8_t type)
+{
+    if (num_events == cap_events) {
+        cap_events = cap_events ? cap_events * 2 : 256;
+        events = realloc(events, cap_events * sizeof(*events));
+    }
+    struct event *e = &events[num_events];
+    memset(e, 0, sizeof(*e));
+    e->at = at;
+    e->seq = num_events++;
+    e->type = type;
+    return e;
+}
+
+static int event_cmp(const void *a, const void *b)
+{
+    const struct event *x = a, *y = b;
+    if (x->at != y->at)
+        return x->at < y->at ? -1 : 1;
+    return x->seq < y->seq ? -1 : 1;
+}
+
+static uint64_t parse_time(const char *s, uint64_t prev, int line)
+{
+    int rel = (*s == '+');
+    char *end;
+    double t = strtod(s + rel, &end);
+    if (end == s + rel) {
+        fprintf(stderr, "line %d: bad time '%s'\n", line, s);
+        exit(2);
+    }
+    if (*end == 'm') t *= 60;
+    else if (*end == 'h') t *= 3600;
+    else if (*end == 'u') t /= 1e6;
+    uint64_t u = (uint64_t)(t * UNITS_PER_SEC + 0.5);
+    return rel ? prev + u : u;
+}
+
+static uint8_t parse_buttons(const char *s, int line)
+{
+    uint8_t mask = 0;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s", s);
+    for (char *b = strtok(buf, "+"); b; b = strtok(NULL, "+")) {
+        if (!strcmp(b, "start")) mask |= _BV(PC2);
+        else if (!strcmp(b, "select")) mask |= _BV(PC3);
+        else if (!strcmp(b, "set")) mask |= _BV(PC4);
+        else {
+            fprintf(stderr, "line %d: unknown button '%s'\n", line, b);
+            exit(2);
+        }
+    }
+    return mask;
+}
+
+static void pin_event(uint64_t at, uint8_t mask, uint8_t level)
+{
+    struct event *e = add_event(at, EV_PINS);
+    e->mask = mask;
+    e->level = level;
+}
+
+// each detent is four edges, 1ms apart (or closer for a quick spin)
+static void turn(uint64_t at, int detents, int ms)
+{
+    uint64_t edge = ms < 8 ? UNITS_PER_SEC / 8000 * ms : UNITS_PER_SEC / 1000;
+    static const uint8_t cw[4] = { 0b10, 0b00, 0b01, 0b11 };
+    static const uint8_t ccw[4] = { 0b01, 0b00, 0b10, 0b11 };
+    const uint8_t *seq = detents > 0 ? cw : ccw;
+    int n = detents > 0 ? detents : -detents;
+    for (int d = 0; d < n; ++d) {
+        for (int i = 0; i < 4; ++i) {
+            uint64_t t = at + d * (UNITS_PER_SEC / 1000 * ms) + i * edge;
+            pin_event(t, 0b11 & ~seq[i], 0);
+            pin_event(t, seq[i], 1);
+        }
+    }
+}
+
+// a worn contact: A flickers every 20us, and settles back open
+static void chatter(uint64_t at, int ms)
+{
+    for (int i = 0; i < ms * 50; ++i)
+        pin_event(at + i * (UNITS_PER_SEC / 50000), 0b01, i & 1);
+    pin_event(at + ms * (UNITS_PER_SEC / 1000), 0b01, 1);
+}
+
+static void load_script(FILE *f)
+{
+    char line[256];
+    uint64_t prev = 0;
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        ++lineno;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = 0;
+        char *argv[4] = { 0 };
+        int argc = 0;
+        for (char *tok = strtok(line, " \t\r\n"); tok && argc < 4; tok = strtok(NULL, " \t\r\n"))
+            argv[argc++] = tok;
+        if (argc == 0)
+            continue;
+        if (argc < 2) {
+            fprintf(stderr, "line %d: expected '<time> <command>'\n", lineno);
+            exit(2);
+        }
+        uint64_t at = parse_time(argv[0], prev, lineno);
+        prev = at;
+        const char *cmd = argv[1];
+        if (!strcmp(cmd, "press") && argc >= 3) {
+            uint8_t mask = parse_buttons(argv[2], lineno);
+            uint64_t hold = argc >= 4 ? parse_time(argv[3], 0, lineno) : UNITS_PER_SEC / 10;
+            pin_event(at, mask, 0);
+            pin_event(at + hold, mask, 1);
+        } else if (!strcmp(cmd, "down") && argc >= 3) {
+            pin_event(at, parse_buttons(argv[2], lineno), 0);
+        } else if (!strcmp(cmd, "up") && argc >= 3) {
+            pin_event(at, parse_buttons(argv[2], lineno), 1);
+        } else if (!strcmp(cmd, "turn") && argc >= 3) {
+            turn(at, atoi(argv[2]), argc >= 4 ? atoi(argv[3]) : 30);
+        } else if (!strcmp(cmd, "chatter") && argc >= 3) {
+            chatter(at, atoi(argv[2]));
+        } else if (!strcmp(cmd, "show")) {
+            add_event(at, EV_SHOW);
+        } else if (!strcmp(cmd, "vcc") && argc >= 3) {
+            add_event(at, EV_VCC)->value = atof(argv[2]);
+        } else if (!strcmp(cmd, "temp") && argc >= 3) {
+            add_event(at, EV_TEMP)->value = atof(argv[2]);
+        } else if (!strcmp(cmd, "expect") && argc >= 4 && !strcmp(argv[2], "pulses")) {
+            add_event(at, EV_EXPECT_PULSES)->value = atof(argv[3]);
+        } else if (!strcmp(cmd, "expect") && argc >= 4 && !strcmp(argv[2], "display")) {
+            struct event *e = add_event(at, EV_EXPECT_DISPLAY);
+            // underscores stand in for blank digits
+            snprintf(e->text, sizeof(e->text), "%s", argv[3]);
+            for (char *c = e->text; *c; ++c)
+                if (*c == '_') *c = ' ';
+        } else if (!strcmp(cmd, "send") && argc >= 3) {
+            struct event *e = add_event(at, EV_SEND);
+            for (const char *h = argv[2]; h[0] && h[1] && e->len < sizeof(e->data); h += 2) {
+                unsigned b;
+                if (sscanf(h, "%2x", &b) != 1) {
+                    fprintf(stderr, "line %d: bad hex '%s'\n", lineno, argv[2]);
+                    exit(2);
+                }
+                e->data[e->len++] = b;
+            }
+        } else if (!strcmp(cmd, "end")) {
+            add_event(at, EV_END);
+        } else {
+            fprintf(stderr, "line %d: unknown command '%s'\n", lineno, cmd);
+            exit(2);
+        }
+    }
+    qsort(events, num_events, sizeof(*events), event_cmp);
+}
+
+// render the frame buffer as text: one character per digit, a trailing '.' for a lit
+// decimal point, and ':' or '\'' for the extra anodes
+static void render_display(char *out)
+{
+    static const struct { uint8_t seg; char c; } glyphs[] = {
+        { 0x03, '0' }, { 0x9F, '1' }, { 0x25, '2' }, { 0x0D, '3' }, { 0x99, '4' },
+        { 0x49, '5' }, { 0x41, '6' }, { 0x1F, '7' }, { 0x01, '8' }, { 0x09, '9' },
+        { 0x11, 'A' }, { 0xC1, 'b' }, { 0x63, 'C' }, { 0x85, 'd' }, { 0x61, 'E' },
+        { 0x71, 'F' }, { 0xE3, 'L' }, { 0x83, 'U' }, { 0xC7, 'v' }, { 0x91, 'H' },
+        { 0xE1, 't' }, { 0x31, 'P' }, { 0xF5, 'r' }, { 0xFD, '-' }, { 0xFF, ' ' },
+    };
+    char *p = out;
+    // refresh stopped: whatever is in the buffer, the LEDs are dark
+    if (!(TCCR0B & 7) || !(TIMSK0 & (1 << OCIE0A))) {
+        strcpy(out, "    ");
+        return;
+    }
+    for (int i = 0; i < 4; ++i) {
+        uint8_t seg = display[i] | 1;
+        char c = '?';
+        for (size_t g = 0; g < sizeof(glyphs) / sizeof(glyphs[0]); ++g)
+            if (glyphs[g].seg == seg)
+                c = glyphs[g].c;
+        *p++ = c;
+        if (!(display[i] & 1))
+            *p++ = '.';
+        if (i == 1 && !(display[EXTRA_POS] & (uint8_t)~COLON))
+            *p++ = ':';
+    }
+    if (!(display[EXTRA_POS] & (uint8_t)~APOS))
+        *p++ = '\'';
+    *p = 0;
+}
+
+static void finish()
+{
+    if (eeprom_file) {
+        FILE *f = fopen(eeprom_file, "wb");
+        if (f) {
+            fwrite(eeprom, 1, sizeof(eeprom), f);
+            fclose(f);
+        }
+    }
+    printf("%12.6f  end: %u full-press pulses", seconds(now), full_pulses);
+    if (full_pulses)
+        printf(" (%.6f .. %.6f s, %.3f s total)",
+               seconds(full_shortest), seconds(full_longest), seconds(full_total));
+    printf(", %u half-press pulses\n", half_pulses);
+    // firmware code takes no virtual time here, so "awake" is only busy-waiting
+    static const char *modes[8] = { "idle", "adc", "power-down", "power-save", "", "", "standby", "ext-standby" };
+    uint64_t asleep = 0;
+    printf("%12s  sleep:", "");
+    for (int i = 0; i < 8; ++i) {
+        if (!slept[i])
+            continue;
+        asleep += slept[i];
+        printf(" %s %.3f s (%u wake-ups),", modes[i], seconds(slept[i]), wakeups[i]);
+    }
+    printf(" awake %.3f s\n", seconds(now - asleep));
+    fflush(stdout);
+    exit(failures ? 1 : 0);
+}
+
+static void run_event(struct event *e)
+{
+    char text[16];
+    switch (e->type) {
+    case EV_PINS:
+        set_pinc(e->mask, e->level);
+        break;
+    case EV_SHOW:
+        render_display(text);
+        printf("%12.6f  display [%s]\n", seconds(now), text);
+        break;
+    case EV_VCC:
+        vcc = e->value;
+        break;
+    case EV_TEMP:
+        temperature = e->value;
+        break;
+    case EV_EXPECT_PULSES:
+        if (full_pulses != (uint32_t)e->value) {
+            printf("%12.6f  FAIL: expected %u full-press pulses, saw %u\n",
+                   seconds(now), (uint32_t)e->value, full_pulses);
+            ++failures;
+        }
+        break;
+    case EV_EXPECT_DISPLAY:
+        render_display(text);
+        if (strcmp(text, e->text)) {
+            printf("%12.6f  FAIL: expected display [%s], saw [%s]\n", seconds(now), e->text, text);
+            ++failures;
+        }
+        break;
+    case EV_SEND:
+        for (uint8_t i = 0; i < e->len; ++i)
+            usart_queue(e->data[i]);
+        break;
+    case EV_END:
+        finish();
+        break;
+    }
+}
+
+// -- the virtual clock
+
+// pick up register writes the firmware made since we last looked
+static void sync_registers()
+{
+    for (int i = 0; i < 3; ++i) {
+        struct timer *t = &timers[i];
+        timer_sync(t);
+        // interrupt flags are cleared by writing a 1
+        if (*t->tifr) {
+            t->pending &= ~*t->tifr;
+            *t->tifr = 0;
+        }
+    }
+    if (PCIFR) {
+        pcint_pending &= ~PCIFR;
+        PCIFR = 0;
+    }
+    ASSR &= ~(_BV(TCN2UB) | _BV(OCR2AUB) | _BV(OCR2BUB) | _BV(TCR2AUB) | _BV(TCR2BUB));
+
+    adc_sync();
+    ee_sync();
+    ee_ready_level = !ee_busy;
+    usart_sync();
+    watch_outputs();
+}
+
+static void publish_registers()
+{
+    if (published_at == now)
+        return;
+    published_at = now;
+    for (int i = 0; i < 3; ++i)
+        timer_publish(&timers[i]);
+}
+
+// run the highest-priority pending interrupt, if interrupts are enabled
+static uint8_t dispatch()
+{
+    if (!(SREG & 0x80))
+        return 0;
+    if (!(timers[0].pending | timers[1].pending | timers[2].pending | pcint_pending | adc_pending
+          | usart_rx_pending)
+        && !(ee_ready_level && (EECR & _BV(EERIE)))
+        && !(udre_level && (UCSR0B & _BV(UDRIE0))))
+        return 0;
+    for (size_t i = 0; i < NUM_VECTORS; ++i) {
+        struct vector *v = &vectors[i];
+        uint8_t flag = _BV(v->bit);
+        if (!(*v->pending & flag) || !(*v->enable_reg & _BV(v->enable_bit)))
+            continue;
+        if (sleeping && !clkio_running() && !v->wakes_from_deep_sleep && v->pending != &adc_pending)
+            continue;
+        if (v->pending != &ee_ready_level && v->pending != &udre_level)
+            *v->pending &= ~flag;
+        if (!v->handler)
+            return 1;
+        if (sleeping)
+            ++wakeups[sleep_mode_bits()];
+        sleeping = 0;
+        publish_registers();
+        SREG &= ~0x80;
+        v->handler();
+        SREG |= 0x80;
+        sync_registers();
+        return 1;
+    }
+    return 0;
+}
+
+// advance virtual time to `until`, servicing interrupts along the way;
+// with `wake` set, return as soon as one interrupt has been serviced
+static void run_until(uint64_t until, uint8_t wake)
+{
+    sync_registers();
+    for (;;) {
+        if (dispatch()) {
+            if (wake)
+                break;
+            continue;
+        }
+        if (now >= until)
+            break;
+
+        uint64_t next = until;
+        for (int i = 0; i < 3; ++i)
+            if (timers[i].next_at < next)
+                next = timers[i].next_at;
+        if (next_event_idx < num_events && events[next_event_idx].at < next)
+            next = events[next_event_idx].at;
+        if (adc_busy && adc_done < next)
+            next = adc_done;
+        if (ee_busy && ee_done < next)
+            next = ee_done;
+        if (tx_done < next)
+            next = tx_done;
+        if (rx_next < next)
+            next = rx_next;
+        // with a pty attached, check in with the outside world every millisecond
+        if (pty_fd >= 0 && now + UNITS_PER_SEC / 1000 < next)
+            next = now + UNITS_PER_SEC / 1000;
+        if (end_at < next)
+            next = end_at;
+        if (next == NEVER) {
+            printf("%12.6f  halted: asleep with nothing left to wake the CPU\n", seconds(now));
+            finish();
+        }
+        if (next > now) {
+            if (sleeping)
+                slept[sleep_mode_bits()] += next - now;
+            now = next;
+        }
+        if (pty_fd >= 0)
+            pty_poll();
+
+        for (int i = 0; i < 3; ++i)
+            if (timers[i].next_at <= now)
+                timer_fire(&timers[i]);
+        while (next_event_idx < num_events && events[next_event_idx].at <= now)
+            run_event(&events[next_event_idx++]);
+        if (adc_busy && adc_done <= now)
+            adc_finish();
+        if (ee_busy && ee_done <= now) {
+            ee_busy = 0;
+            ee_ready_level = 1;
+            EECR &= ~_BV(EEPE);
+        }
+        if (tx_done <= now)
+            usart_tx_finish();
+        if (rx_next <= now)
+            usart_rx_finish();
+        usart_sync();
+        if (now >= end_at)
+            finish();
+    }
+    publish_registers();
+}
+
+// -- hooks called from the stand-in AVR headers
+
+void sim_sei(void)
+{
+    SREG |= 0x80;
+    run_until(now, 0);
+}
+
+void sim_cli(void)
+{
+    SREG &= ~0x80;
+}
+
+void sim_sleep(void)
+{
+    if (!(SMCR & _BV(SE)))
+        return;
+    if (!(SREG & 0x80)) {
+        printf("%12.6f  halted: sleeping with interrupts disabled\n", seconds(now));
+        finish();
+    }
+    sleeping = 1;
+    // entering ADC noise reduction mode starts a conversion
+    if (sleep_mode_bits() == 1 && (ADCSRA & _BV(ADEN)) && !adc_busy)
+        ADCSRA |= _BV(ADSC);
+    run_until(NEVER, 1);
+    sleeping = 0;
+}
+
+void sim_delay_cycles(double cycles)
+{
+    run_until(now + (uint64_t)(cycles * cpu_units()), 0);
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: astro-timer-sim [-q] [-p] [-e eeprom.bin] [-t seconds] script\n"
+        "  -q  don't log shutter edges or USART output\n"
+        "  -p  bridge the USART to a pseudo-terminal, running in real time\n"
+        "  -e  load EEPROM contents from (and save them back to) a file\n"
+        "  -t  stop after this much virtual time (accepts m/h suffixes)\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "qpe:t:")) != -1) {
+        switch (opt) {
+        case 'q': quiet = 1; break;
+        case 'p': open_pty(); break;
+        case 'e': eeprom_file = optarg; break;
+        case 't': end_at = parse_time(optarg, 0, 0); break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+
+    FILE *f = strcmp(argv[optind], "-") ? fopen(argv[optind], "r") : stdin;
+    if (!f) {
+        perror(argv[optind]);
+        return 2;
+    }
+    load_script(f);
+    if (f != stdin)
+        fclose(f);
+
+    memset(eeprom, 0xFF, sizeof(eeprom));
+    if (eeprom_file) {
+        FILE *e = fopen(eeprom_file, "rb");
+        if (e) {
+            if (fread(eeprom, 1, sizeof(eeprom), e) == 0)
+                memset(eeprom, 0xFF, sizeof(eeprom));
+            fclose(e);
+        }
+    }
+
+    // reset state: CKDIV8 fuse programmed, so the CPU starts at 1MHz
+    CLKPR = 3;
+    UDR0 = 0x100;
+    for (int i = 0; i < 3; ++i)
+        timers[i].next_at = NEVER;
+
+    firmware_main();
+    finish();
+    return 0;
+}
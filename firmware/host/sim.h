@@ -0,0 +1,13 @@
+#pragma once
+
+// host simulator hooks used by the stand-in AVR headers
+
+#include <stdint.h>
+
+void sim_sei(void);
+void sim_cli(void);
+void sim_sleep(void);
+void sim_delay_cycles(double cycles);
+uint8_t sim_read_pinc(void);
+volatile uint8_t *sim_eedr(void);
+uint8_t sim_signature_byte(uint8_t addr);
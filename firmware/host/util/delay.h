@@ -0,0 +1,9 @@
+#pragma once
+
+// host stand-in for <util/delay.h>: busy-waits burn virtual CPU cycles,
+// with interrupts firing in the meantime just as they would on the device
+
+#include "../sim.h"
+
+#define _delay_us(us) sim_delay_cycles((double)(us) * (F_CPU / 1000000.0))
+#define _delay_ms(ms) sim_delay_cycles((double)(ms) * (F_CPU / 1000.0))
@@ -4,128 +4,367 @@
 #include "input.h"
 #include "settings.h"
 #include "io.h"
+#include "sequence.h"
+#include "energy.h"
+#include "instrument.h"
+
+// timer1 counts at F_CPU/8, and wraps every 50ms
+#define CYCLE_MS  50
+#define CYCLE_TOP (F_CPU / 8 / (1000 / CYCLE_MS))
+
+_Static_assert(CYCLE_TOP <= 0xFFFF, "the 50ms cycle doesn't fit timer1 at this F_CPU");
+_Static_assert(CYCLE_TOP % CYCLE_MS == 0, "the 1ms tick needs a whole number of timer1 counts");
+
+// a 1ms tick (timer1 compare B) runs while buttons are settling, or while
+// a bounce storm lasts
+#define TICK_PERIOD (CYCLE_TOP / CYCLE_MS)
+
+// a bounce storm: more pin changes than this in one 50ms cycle (a hard spin
+// makes fewer than 20) stops the pin-change interrupt, and the tick samples
+// the pins instead...
+#define STORM_EDGES   48
+// ...until a cycle with no more changes than this
+#define CALM_CHANGES  12
+
+// a button has to hold still this long (in ms) for a press or release to count
+#define DEBOUNCE_MS 4
+
+// and stay down this long to count as held
+#define HOLD_MS 1000
+
+// detent-to-detent times (in ms) that count as a fast spin: a detent this soon
+// after the last one moves the value ten steps, or five
+#define SPIN_FAST  12
+#define SPIN_BRISK 24
+
+// and 1/1 while the system clock is slowed by 8, so timer1's counts keep their length
+#define T1_CLOCK_SELECT      (1 << CS11)
+#define T1_CLOCK_SELECT_SLOW (1 << CS10)
 
 void input_init()
 {
-    OCR1A = 12500;                       // 50ms cycle at 2MHz
-    TCCR1B = (1 << WGM12) | (1 << CS11); // start timer at 1/8 prescaler, in CTC mode
+    OCR1A = CYCLE_TOP;                   // 50ms cycle
+    TCCR1B = (1 << WGM12) | T1_CLOCK_SELECT; // start timer at 1/8 prescaler, in CTC mode
     TIMSK1 = (1 << OCIE1A);              // enable compare match A interrupt
 
-    // enable pin-change interrupt on encoder inputs
-    PCMSK1 = (1 << PCINT8) | (1 << PCINT9);
-    PCICR = (1 << PCIE1);
+    // enable pin-change interrupt on encoder and button inputs
+    INPUT_PCMSK = INPUT_PCMSK_ENCODER | INPUT_PCMSK_BUTTONS;
+    PCICR = (1 << INPUT_PCIE);
 }
 
 volatile uint8_t input_ready = 0;
+uint8_t input_cycle = 0;
 volatile int8_t encoder_ticks = 0;
 
-// triggers every 50ms, used to sample tac buttons and drive the state machine
+static volatile uint16_t cycle_ms;  // start of the current 50ms cycle
+
+static uint8_t enc_hist = 0b11; // the last two encoder pin states, [prevB prevA curB curA]
+static uint8_t edges;           // pin changes seen this cycle
+static uint8_t enc_idle = 255;  // whole cycles since the last detent, saturating
+static uint8_t storm;
+
+// button states are BUTTON_* masks, set while the button is down
+static uint8_t btn_seen;        // as of the last pin change
+static uint8_t btn_down;        // debounced
+static uint8_t settling;        // buttons that have changed, and are waiting out DEBOUNCE_MS
+static uint8_t settle_ms[3];
+
+// debounced presses and releases, from the tick to input_poll(). only the
+// tick writes ev_head, and only input_poll() writes ev_tail, so neither
+// side needs to lock the other out
+#define EVENT_QUEUE_SIZE 8
+
+struct button_event {
+    uint8_t button;
+    uint8_t down;
+    uint16_t time;
+};
+
+static struct button_event events[EVENT_QUEUE_SIZE];
+static volatile uint8_t ev_head, ev_tail;
+
+// power_down() watches the buttons itself
+static uint8_t suspended;
+
+// milliseconds, wrapping every minute or so. call with interrupts off
+static uint16_t now_ms()
+{
+    uint16_t t = TCNT1;
+    uint16_t ms = cycle_ms;
+    // timer1 has wrapped, but its interrupt hasn't run yet
+    if ((TIFR1 & (1 << OCF1A)) && t < CYCLE_TOP / 2)
+        ms += CYCLE_MS;
+    return ms + t / TICK_PERIOD;
+}
+
+static void tick_on()
+{
+    if (TIMSK1 & (1 << OCIE1B))
+        return;
+    uint16_t next = TCNT1 + TICK_PERIOD;
+    OCR1B = (next > CYCLE_TOP) ? next - CYCLE_TOP - 1 : next;
+    TIFR1 = (1 << OCF1B);
+    TIMSK1 |= (1 << OCIE1B);
+}
+
+// triggers every 50ms, used to drive the state machine
 ISR(TIMER1_COMPA_vect)
 {
+    INSTR_ENTER();
     input_ready = 1;
+    cycle_ms += CYCLE_MS;
+    energy_cycle();
+
+    if (enc_idle < 255)
+        ++enc_idle;
+
+    // the storm is over; go back to waiting for edges
+    if (storm && edges <= CALM_CHANGES) {
+        storm = 0;
+        INPUT_PCMSK |= INPUT_PCMSK_ENCODER | INPUT_PCMSK_BUTTONS;
+    }
+    edges = 0;
+    INSTR_EXIT(INSTR_CYCLE);
+    INSTR_FRAME(CYCLE_TOP + 1);
 }
 
-// the following ISR is adapted from
+// how far a detent moves the value, by how soon it came after the last one
+static int8_t detent_step()
+{
+    static uint16_t last;
+
+    uint16_t t = now_ms();
+    // the millisecond count wraps, but enc_idle doesn't
+    uint16_t dt = (enc_idle > 1) ? 0xffff : t - last;
+    last = t;
+    enc_idle = 0;
+
+    return (dt < SPIN_FAST) ? 10 : (dt < SPIN_BRISK) ? 5 : 1;
+}
+
+// the following decoder is adapted from
 // https://chome.nerpa.tech/mcu/rotary-encoder-interrupt-service-routine-for-avr-micros/
 // expects encoder with four state changes between detents and both pins open on detent
-ISR(PCINT1_vect)
+static void decode(uint8_t enc_bits)
 {
     // indexed by bits [prevB prevA curB curA], indicates the direction of rotation
     // or 0 for no change/bouncing state
     static const int8_t enc_states[] PROGMEM = {0,1,-1,0,-1,0,0,1,1,0,0,-1,0,-1,1,0};
 
-    static uint8_t enc_hist = 0b11;
     static int8_t enc_cycle = 0;
 
-    uint8_t enc_bits = (PINC & 0b11);
     enc_hist <<= 2;
     enc_hist |= enc_bits;
 
     enc_cycle += pgm_read_byte(&enc_states[enc_hist & 0b1111]);
 
     // see if we've moved from detent to detent, and record the tick
-    if (enc_bits == 0b11) {
-        if(enc_cycle > 3) {
-            encoder_ticks += enc_cw;
-            enc_cycle = 0;
-        } else if(enc_cycle < -3) {
-            encoder_ticks -= enc_cw;
-            enc_cycle = 0;
-        }
+    if (enc_bits == 0b11 && (enc_cycle > 3 || enc_cycle < -3)) {
+        int8_t step = detent_step();
+        if (enc_cycle < 0)
+            step = -step;
+        enc_cycle = 0;
+        // saturate, however hard it's spun between polls
+        int8_t t = encoder_ticks + step * enc_cw;
+        if (t > -100 && t < 100)
+            encoder_ticks = t;
     }
 }
 
-// here's how button presses work:
-// - a press is registered when a button is released.
-// - a hold is registered when the same button has been down
-//   for a specified number of cycles.  the button release
-//   following the hold does not register.
-// - if async button state is queried, any pending event is suppressed
-//   (this is used for click+turn navigation)
-
-#define REPEAT_THRESHOLD 20
-
-uint8_t GetButtons(uint8_t async)
+// restart the settling time of any button that has moved
+static void buttons_moved(uint8_t keys)
 {
-    static uint8_t prevState = 0xff;
-    static uint8_t repeat = 0;
+    uint8_t moved = (~keys & 0b111) ^ btn_seen;
+    if (!moved)
+        return;
+    btn_seen ^= moved;
+    settling |= moved;
+    for (uint8_t i = 0; i < 3; ++i)
+        if (moved & (1 << i))
+            settle_ms[i] = DEBOUNCE_MS;
+    tick_on();
+}
 
-    uint8_t curState = BUTTON_STATE();
+ISR(INPUT_PCINT_vect)
+{
+    if (suspended)
+        return;
+    INSTR_ENTER();
 
-    if (async) {
-        repeat = REPEAT_THRESHOLD;
-        return (~curState & 0x7);
+    // a bouncing contact can fire this at any rate, so past a limit, stop listening
+    // to the pins and sample them instead
+    if (++edges == STORM_EDGES) {
+        INPUT_PCMSK &= ~(INPUT_PCMSK_ENCODER | INPUT_PCMSK_BUTTONS);
+        storm = 1;
+        edges = 0;
+        tick_on();
     }
 
-    // if we've already registered a "hold"
-    if (repeat >= REPEAT_THRESHOLD) {
-        if (curState == 0x7)
-            repeat = 0;    // no buttons are down.
-        prevState = curState;
-        return 0;
+    buttons_moved(BUTTON_STATE());
+    uint8_t enc_bits = ENCODER_STATE();
+    if (enc_bits != (enc_hist & 0b11))
+        decode(enc_bits);
+    INSTR_EXIT(INSTR_PCINT);
+}
+
+// the 1ms tick: debounce the buttons, and sample the encoder during a storm
+ISR(TIMER1_COMPB_vect)
+{
+    INSTR_ENTER();
+    uint16_t next = OCR1B + TICK_PERIOD;
+    OCR1B = (next > CYCLE_TOP) ? next - CYCLE_TOP - 1 : next;
+
+    if (storm) {
+        uint8_t enc_bits = ENCODER_STATE();
+        if (enc_bits != (enc_hist & 0b11)) {
+            if (edges < 255)
+                ++edges;
+            decode(enc_bits);
+        }
+        buttons_moved(BUTTON_STATE());
     }
 
-    // if the encoder moves while a button is held, suppress the event
-    if (encoder_ticks && (curState != 0x7)) {
-        repeat = REPEAT_THRESHOLD;
-        prevState = curState;
-        return 0;
+    for (uint8_t i = 0; i < 3; ++i) {
+        uint8_t b = 1 << i;
+        if (!(settling & b) || --settle_ms[i])
+            continue;
+        settling &= ~b;
+        if ((btn_seen ^ btn_down) & b) {
+            btn_down ^= b;
+            uint8_t h = ev_head;
+            uint8_t n = (h + 1) % EVENT_QUEUE_SIZE;
+            if (n != ev_tail) {
+                events[h].button = b;
+                events[h].down = btn_down & b;
+                events[h].time = now_ms();
+                ev_head = n;
+            }
+        }
     }
 
-    if (curState != prevState) {
-        repeat = 0;
-        uint8_t pressed = ~prevState & curState;
-        prevState = curState;
-        return pressed;
-    } else if (curState != 0x7) {
-        // button(s) are being held
-        if (++repeat == REPEAT_THRESHOLD) {
-            return BUTTON_HOLD | (~curState & 0x7);
+    if (!storm && !settling)
+        TIMSK1 &= ~(1 << OCIE1B);
+    INSTR_EXIT(INSTR_TICK);
+}
+
+
+
+// here's how button presses work:
+// - a press is registered when a button is released.
+// - a hold is registered when the same buttons have been down
+//   for HOLD_MS.  the button release following the hold does not register.
+// - turning the encoder while a button is down makes a click+turn
+//   navigation event instead, and the release doesn't register either.
+
+static uint8_t down;            // as of the last event we've taken
+static uint16_t changed_at;     // when that was
+static uint8_t swallow;         // ignore releases until all the buttons are up
+
+// take events from the queue; returns the buttons released
+static uint8_t take_events()
+{
+    uint8_t released = 0;
+    while (ev_tail != ev_head) {
+        struct button_event *e = &events[ev_tail];
+        if (e->down) {
+            down |= e->button;
+        } else {
+            down &= ~e->button;
+            // turning the knob just before letting go is still a click+turn
+            if (!swallow && !encoder_ticks)
+                released |= e->button;
         }
+        if (!down)
+            swallow = 0;
+        changed_at = e->time;
+        ev_tail = (ev_tail + 1) % EVENT_QUEUE_SIZE;
     }
+    return released;
+}
 
-    return 0;
+#ifdef SYSCLK_SLOW
+void input_retime(uint8_t slow)
+{
+    _Static_assert(SYSCLK_SLOW == 8, "no timer1 prescaler to match the slowed clock");
+    // OCR1A, OCR1B and the millisecond count stay as they are
+    if (TCCR1B & 7)
+        TCCR1B = (TCCR1B & ~7) | (slow ? T1_CLOCK_SELECT_SLOW : T1_CLOCK_SELECT);
+}
+#endif
+
+void input_suspend()
+{
+    suspended = 1;
+}
+
+void input_resume()
+{
+    uint8_t keys = BUTTON_STATE();
+    // the buttons that woke us are still down, and letting go of them isn't a press
+    if (keys != 0b111)
+        swallow = 1;
+    cli();
+    suspended = 0;
+    buttons_moved(keys);
+    sei();
 }
 
 void input_poll(uint8_t *button_mask, int8_t *encoder_diff)
 {
+    uint8_t pressed = 0;
+
     set_sleep_mode(SLEEP_MODE_IDLE);
-    while (!input_ready) {
-        sleep_mode();
+    for (;;) {
+        pressed |= take_events();
+        // check and sleep with interrupts off, so an event that arrives after
+        // the check still wakes us (sei's next instruction runs before any ISR)
+        cli();
+        if (pressed || input_ready || sequence_changed) {
+            sei();
+            break;
+        }
+        if (ev_tail != ev_head) {
+            // an event came in after take_events(); take it first
+            sei();
+            continue;
+        }
+        INSTR_SLEEP();
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        INSTR_WOKE();
+    }
+    sequence_changed = 0;
+    *button_mask = pressed;
+    *encoder_diff = 0;
+    input_cycle = input_ready;
+    if (!input_ready) {
+        // a sequence moved on or a button was released between polls; let the
+        // state machine move on now rather than up to 50ms later (and leave the
+        // encoder for the next poll)
+        return;
     }
     input_ready = 0;
-    uint8_t button_state = GetButtons(encoder_ticks);
-    if (encoder_ticks && button_state) {
-        *encoder_diff = 0;
-        if (button_state & BUTTON_SET) {
-            *button_mask = (encoder_ticks > 0) ? BRIGHT_UP : BRIGHT_DOWN;
+
+    cli();
+    int8_t ticks = encoder_ticks;
+    encoder_ticks = 0;
+    uint16_t t = now_ms();
+    sei();
+
+    if (ticks && down) {
+        swallow = 1;
+        if (down & BUTTON_SET) {
+            *button_mask = (ticks > 0) ? BRIGHT_UP : BRIGHT_DOWN;
         } else {
-            *button_mask = (encoder_ticks > 0) ? BUTTON_SELECT : BUTTON_BACK;
+            *button_mask = (ticks > 0) ? BUTTON_SELECT : BUTTON_BACK;
         }
     } else {
-        *encoder_diff = encoder_ticks;
-        *button_mask = button_state;
+        *encoder_diff = ticks;
+        if (down && !swallow && (uint16_t)(t - changed_at) >= HOLD_MS) {
+            swallow = 1;
+            *button_mask |= BUTTON_HOLD | down;
+        }
     }
-    encoder_ticks = 0;
 }
-
@@ -14,5 +14,16 @@ void input_init();
 #define BRIGHT_DOWN   0x20
 #define BRIGHT_UP     0x40
 
-// wait for the next input cycle (~50ms) and return input status
+// wait for the next input cycle (~50ms), a button press, or a clock countdown to finish,
+// and return input status
 void input_poll(uint8_t *button_mask, int8_t *encoder_diff);
+// nonzero if the last input_poll() ended an input cycle, zero if it returned
+// early; count time by this, not by polls
+extern uint8_t input_cycle;
+
+// keep the 50ms cycle as the system clock is slowed (or not); see sysclk_slow()
+void input_retime(uint8_t slow);
+
+// stop and restart input handling around power_down(), which waits on the buttons itself
+void input_suspend();
+void input_resume();
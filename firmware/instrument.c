@@ -0,0 +1,100 @@
+#include "instrument.h"
+
+#ifdef INSTRUMENT
+
+#include "display.h"
+
+volatile uint8_t instr_sleeping;
+volatile uint16_t instr_slept_at;
+volatile uint16_t instr_slept;
+volatile uint16_t instr_calls[INSTR_ISRS];
+volatile uint32_t instr_counts[INSTR_ISRS];
+volatile uint16_t instr_late;
+
+#define FRAMES_PER_SEC 20
+
+static uint8_t frames;
+static uint32_t awake;
+static uint16_t frame_counts = 1;
+
+// the last whole second, for the page
+static uint32_t last_awake;
+static uint16_t last_calls[INSTR_ISRS];
+static uint32_t last_counts[INSTR_ISRS];
+static uint16_t peak;           // the busiest frame's awake counts
+
+void instr_frame(uint16_t counts)
+{
+    uint16_t slept = instr_slept;
+    instr_slept = 0;
+    uint16_t a = (slept < counts) ? counts - slept : 0;
+    if (a > peak)
+        peak = a;
+    awake += a;
+    frame_counts = counts;
+
+    if (++frames < FRAMES_PER_SEC)
+        return;
+    frames = 0;
+    last_awake = awake;
+    awake = 0;
+    for (uint8_t i = 0; i < INSTR_ISRS; ++i) {
+        last_calls[i] = instr_calls[i];
+        last_counts[i] = instr_counts[i];
+        instr_calls[i] = 0;
+        instr_counts[i] = 0;
+    }
+}
+
+void instr_reset()
+{
+    cli();
+    peak = 0;
+    instr_late = 0;
+    sei();
+}
+
+// counts over a second, in tenths of a percent
+static uint16_t per_mille(uint32_t counts)
+{
+    return counts * 1000 / ((uint32_t)frame_counts * FRAMES_PER_SEC);
+}
+
+void display_instrument(uint8_t item)
+{
+    cli();
+    uint32_t a = last_awake;
+    uint16_t p = peak;
+    uint16_t late = instr_late;
+    uint8_t isr = (item - 3) / 2;
+    uint16_t calls = (item >= 3) ? last_calls[isr] : 0;
+    uint32_t counts = (item >= 3) ? last_counts[isr] : 0;
+    sei();
+
+    switch (item) {
+    case 0:
+        DisplayAlnum(LETTER_A, per_mille(a), 0, 2);
+        break;
+    case 1:
+        DisplayAlnum(LETTER_P, per_mille((uint32_t)p * FRAMES_PER_SEC), 0, 2);
+        break;
+    case 2: {
+        uint32_t us = (uint32_t)late * 1000 / (F_CPU / 1000);
+        DisplayAlnum(LETTER_L, us > 999 ? 999 : us, 0, 0);
+        break;
+    }
+    default: {
+        // the ISR's number, with a decimal point for its calls, to set them
+        // apart from the number
+        DisplayHex(isr, HIGH_POS);
+        uint8_t label = frame[1];
+        if (item & 1)
+            DisplayAlnum(label, calls > 999 ? 999 : calls, 0, 8);
+        else
+            DisplayAlnum(label, per_mille(counts), 0, 2);
+        break;
+    }
+    }
+}
+
+#endif
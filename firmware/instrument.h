@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+// CPU load instrumentation, for the diagnostic page (make INSTRUMENT=1; without
+// it the macros below are empty, and the page isn't in the options menu).
+//
+// Timer1 (see input.c) is the stopwatch: it counts F_CPU/8 and wraps every 50ms
+// input cycle, so everything is timed in 8-cycle counts, modulo the cycle. It
+// times:
+//  - each instrumented ISR, from its first statement to its last; the register
+//    saves and restores either side, ~20-40 cycles, aren't counted
+//  - input_poll()'s idle sleep, which ends when the first ISR starts. Whatever
+//    isn't asleep there is awake: the main loop, every ISR and its overhead.
+//    (The other sleeps don't count as sleep: ADC noise reduction stops timer1,
+//    and power-save stops it altogether)
+//  - how late the refresh ISR starts after its compare match, from TCNT0, to
+//    the timer0 tick (32us at 2MHz). A late refresh is what makes a digit sparkle
+//    (see display.c)
+// The counts are totalled over a second, then published for the page.
+
+enum {
+    INSTR_REFRESH,      // TIMER0_COMPA, display refresh
+    INSTR_BLANK,        // TIMER0_COMPB, display blanking
+    INSTR_CYCLE,        // TIMER1_COMPA, the 50ms input cycle
+    INSTR_TICK,         // TIMER1_COMPB, the 1ms debounce tick
+    INSTR_PCINT,        // the encoder and keys
+    INSTR_CLOCK,        // TIMER2_COMPA, the 1/8 s clock and the sequencer
+    INSTR_RTC,          // TIMER2_OVF, the time of day
+    INSTR_ISRS
+};
+
+#ifdef INSTRUMENT
+
+extern volatile uint8_t instr_sleeping;
+extern volatile uint16_t instr_slept_at;
+extern volatile uint16_t instr_slept;
+extern volatile uint16_t instr_calls[INSTR_ISRS];
+extern volatile uint32_t instr_counts[INSTR_ISRS];
+extern volatile uint16_t instr_late;
+
+// timer1 counts since then, across the wrap
+static inline uint16_t instr_since(uint16_t then)
+{
+    uint16_t now = TCNT1;
+    return (now >= then) ? now - then : now + OCR1A + 1 - then;
+}
+
+// an ISR starting ends the idle sleep, if we were in it
+static inline uint16_t instr_begin()
+{
+    uint16_t t = TCNT1;
+    if (instr_sleeping) {
+        instr_sleeping = 0;
+        instr_slept += (t >= instr_slept_at) ? t - instr_slept_at : t + OCR1A + 1 - instr_slept_at;
+    }
+    return t;
+}
+
+static inline void instr_end(uint8_t isr, uint16_t t0)
+{
+    ++instr_calls[isr];
+    instr_counts[isr] += instr_since(t0);
+}
+
+// with interrupts off, just before the sleep that turns them back on
+static inline void instr_sleep()
+{
+    instr_slept_at = TCNT1;
+    instr_sleeping = 1;
+}
+
+// woken by an ISR that isn't instrumented
+static inline void instr_woke()
+{
+    cli();
+    if (instr_sleeping) {
+        instr_sleeping = 0;
+        instr_slept += instr_since(instr_slept_at);
+    }
+    sei();
+}
+
+// the end of an input cycle of `counts` timer1 counts, from its ISR
+void instr_frame(uint16_t counts);
+
+#define INSTR_ENTER()       uint16_t instr_t0 = instr_begin()
+#define INSTR_EXIT(isr)     instr_end(isr, instr_t0)
+#define INSTR_SLEEP()       instr_sleep()
+#define INSTR_WOKE()        instr_woke()
+#define INSTR_LATE(cycles)  do { uint16_t l = (cycles); if (l > instr_late) instr_late = l; } while (0)
+#define INSTR_FRAME(counts) instr_frame(counts)
+
+// the diagnostic page's items, by the knob:
+//   A nn.n   awake, percent of the last second
+//   P nn.n   the busiest 50ms cycle, percent, since the last reset
+//   L nnn    the latest the refresh ISR has started, in us, since the last reset
+//   i.nnn    calls to ISR i (INSTR_* above) in the last second (up to 999)
+//   i nn.n   and the percent of the CPU it took
+#define INSTR_ITEMS (3 + 2 * INSTR_ISRS)
+void display_instrument(uint8_t item);
+// start the worst cases over
+void instr_reset();
+
+#else
+
+#define INSTR_ENTER()
+#define INSTR_EXIT(isr)
+#define INSTR_SLEEP()
+#define INSTR_WOKE()
+#define INSTR_LATE(cycles)
+#define INSTR_FRAME(counts)
+
+#endif
@@ -1,25 +1,70 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
+#include <avr/power.h>
 #include <util/delay.h>
 #include "io.h"
 #include "display.h"
 #include "clock.h"
+#include "settings.h"
+#include "input.h"
+#include "energy.h"
+#include "sensors.h"
+
+// the system clock is the 8MHz internal RC oscillator, divided down to F_CPU
+#define RC_OSC 8000000UL
+
+#if F_CPU == RC_OSC
+#define CLOCK_DIV_BITS 0
+#elif F_CPU == RC_OSC / 2
+#define CLOCK_DIV_BITS (1 << CLKPS0)
+#elif F_CPU == RC_OSC / 4
+#define CLOCK_DIV_BITS (1 << CLKPS1)
+#elif F_CPU == RC_OSC / 8
+#define CLOCK_DIV_BITS ((1 << CLKPS1) | (1 << CLKPS0))
+#else
+#error "F_CPU must be 8MHz, 4MHz, 2MHz or 1MHz"
+#endif
 
 void sysclk_init()
 {
     CLKPR = (1 << CLKPCE);
-    CLKPR = (1 << CLKPS1); // 1/4 prescaler, for 2MHz operation
+    CLKPR = CLOCK_DIV_BITS;
+}
+
+uint8_t sysclk_slowed = 0;
+
+uint8_t sysclk_slow(uint8_t slow)
+{
+    uint8_t was = sysclk_slowed;
+#ifdef SYSCLK_SLOW
+    slow = slow ? 1 : 0;
+    if (slow == was)
+        return was;
+    uint8_t div = slow ? CLOCK_DIV_BITS + 3 : CLOCK_DIV_BITS;     // a further 1/8
+    // the clock and the prescalers change together, a few cycles apart, with
+    // nothing to interrupt them; the timers lose or gain a fraction of a count.
+    // clock_prescale_set() makes CLKPR's timed write sequence in assembly, so
+    // the compiler can't put anything between its two writes
+    uint8_t sreg = SREG;
+    cli();
+    clock_prescale_set((clock_div_t)div);
+    display_retime(slow);
+    input_retime(slow);
+    sysclk_slowed = slow;
+    SREG = sreg;
+#endif
+    return was;
 }
 
 void io_init()
 {
-    DDRB  = 0b00111111;
-    PORTB = 0b00000000;
-    DDRC  = 0b00100000;
-    PORTC = 0b00011100;
-    DDRD  = 0b11111111;
-    PORTD = 0b11111111;
+    DDRB  = BOARD_DDRB;
+    PORTB = BOARD_PORTB;
+    DDRC  = BOARD_DDRC;
+    PORTC = BOARD_PORTC;
+    DDRD  = BOARD_DDRD;
+    PORTD = BOARD_PORTD;
 }
 
 // flash the apostrophe. useful for "is this code being reached?"
@@ -38,22 +83,37 @@ void power_init()
     PRR = (1 << PRTWI) | (1 << PRSPI) | (1 << PRUSART0) | (1 << PRADC);
 }
 
-// display "OFF" for a second (or longer)
+// display "OFF" for a second (or longer), with the apostrophe if a scheduled
+// start will wake us
 void acknowledge_power_off()
 {
-    display[0] = EMPTY;
-    display[1] = LETTER_O;
-    display[2] = LETTER_F;
-    display[3] = LETTER_F;
-    display[4] = EMPTY;
+    frame[0] = EMPTY;
+    frame[1] = LETTER_O;
+    frame[2] = LETTER_F;
+    frame[3] = LETTER_F;
+    frame[4] = (rtc_armed() == RTC_OFF) ? EMPTY : APOS;
+    display_commit();
+    display_set_power(DISPLAY_ON);
     _delay_ms(1000);
     // wait for the button to be released, so the release event doesn't wake us up again
     while(BUTTON_STATE() != 0x7);
 }
 
-// go into as deep a sleep as we can manage, waking up on button input
+// seconds asleep between temperature readings for the crystal compensation, as
+// COMPENSATE_CYCLES does while a sequence runs
+#define COMPENSATE_SECS 60
+
+// the two-button wake check samples about every 50ms (in 1/256 s timer2 counts)
+#define WAKE_SAMPLE_COUNTS 13
+
+// sleep as deeply as we can while keeping the crystal running (so waking up
+// never waits for it to restart, and the time of day is kept), waking up on
+// button input or the scheduled start time
 void power_down()
 {
+    // let a save in progress finish; it needs the CPU awake to feed it
+    settings_flush();
+
     // stop interrupts so things don't change out from underneath us
     cli();
 
@@ -62,36 +122,64 @@ void power_down()
     SHUTTER_OFF();
     SHUTTER_HALFPRESS_OFF();
 
-    // stop all timers
-    uint8_t saved_TCCR2B = TCCR2B;
-    TCCR2B = 0;
+    // stop the system-clocked timers; timer2 runs on
     uint8_t saved_TCCR1B = TCCR1B;
     TCCR1B = 0;
     uint8_t saved_TCCR0B = TCCR0B;
     TCCR0B = 0;
 
+    // we'll watch the buttons ourselves
+    input_suspend();
+
     // save pin-change interrupt state, and enable the interrupt on button input
     // (not encoder-turning input, because that can easily happen in a camera bag)
-    uint8_t saved_PCMSK1 = PCMSK1;
-    PCMSK1 = 0b00011100;
+    uint8_t saved_PCMSK = INPUT_PCMSK;
+    INPUT_PCMSK = INPUT_PCMSK_BUTTONS;
     uint8_t saved_PCICR = PCICR;
-    PCICR = (1 << PCIE1);
+    PCICR = (1 << INPUT_PCIE);
 
     // re-enable interrupts so we can actually wake up
     sei();
 
+    // the time of day at the last wake, for the energy accounting
+    uint32_t woke = rtc_now();
+    uint8_t compensate_secs = 0;
+
     for(;;) {
-        // power down!
-        set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+        // power save! only the crystal and the pin-change logic stay up
+        set_sleep_mode(SLEEP_MODE_PWR_SAVE);
         sleep_mode();
 
+        // the seconds since the last wake went by asleep (the clock wakes us at
+        // least once a second, so it can't have gone round a whole day)
+        uint32_t now = rtc_now();
+        uint16_t slept = now >= woke ? now - woke : now + RTC_DAY - woke;
+        energy_asleep(slept);
+        woke = now;
+
+        // the clock wakes us every second; mostly, straight back to sleep
+        if (rtc_alarm)
+            break;
+
+        // keep the compensation up with the temperature, for the time of day
+        // and a scheduled start; the night cools down while we wait. A reading
+        // is a few ms in ADC noise reduction, which timer2 sleeps through
+        compensate_secs += slept;
+        if (compensate_secs >= COMPENSATE_SECS) {
+            compensate_secs = 0;
+            clock_compensate(temp_celsius(read_temp()));
+        }
+        if (BUTTON_STATE() == 0b111)
+            continue;
+
         // a pin-change interrupt woke us up.
         // to avoid spurious wakeups in the camera bag, ensure *two* buttons are held for 300ms
-        // and snooze for awhile longer to swallow the button release
+        // and snooze for awhile longer to swallow the button release. Between samples
+        // we're back in power-save, woken by timer2
         uint8_t hc = 0;
         for(uint8_t delay = 0; delay < 15; ++delay) {
-            _delay_ms(50);
-            uint8_t buttons = (PINC & 0b00011100) >> 2;
+            clock_snooze(WAKE_SAMPLE_COUNTS);
+            uint8_t buttons = BUTTON_STATE();
             if (buttons != 0b001 && buttons != 0b010 && buttons != 0b100)
                 break;
             ++hc;
@@ -100,12 +188,9 @@ void power_down()
             break;
     }
     // restore prior state
-    PCMSK1 = saved_PCMSK1;
+    INPUT_PCMSK = saved_PCMSK;
     PCICR = saved_PCICR;
     TCCR0B = saved_TCCR0B;
     TCCR1B = saved_TCCR1B;
-    TCCR2B = saved_TCCR2B;
-
-    // wait for the crystal to start ticking
-    clock_wait_for_xtal();
+    input_resume();
 }
@@ -4,36 +4,24 @@
 
 void sysclk_init();
 
-void io_init();
-
-// Port assignments:
-// PORTB0..3 (output) = Digit anode drivers
-// PORTB4    (output) = colon / apostrophe anodes
-// PORTB5    (output) = Camera shutter output (full-press)
-// PORTB6..7          = 32.768kHz watch crystal
-// PORTC0    (input)  = Encoder clock
-// PORTC1    (input)  = Encoder data
-// PORTC2    (input)  = Start (encoder) key
-// PORTC3    (input)  = Select key
-// PORTC4    (input)  = Set key
-// PORTC5    (output) = Camera shutter output (half-press)
-// PORTD0..7 (output) = Segment cathodes (PD7 = A, PD6 = B, ... PD0 = DP)
-
-// for portability, please put all explicit port references here and init_io()
-#define DIGITS_OFF()   PORTB &= 0b11100000;
-#define DIGIT_ON(x)    PORTB |= (1 << x)
-
-#define SHUTTER_OFF()  PORTB &= ~(1 << PB5)
-#define SHUTTER_ON()   PORTB |= (1 << PB5)
+// With the display dark there's nothing to draw, so the CPU can run slower: at
+// F_CPU / SYSCLK_SLOW (250kHz at 2MHz). Timer0 and timer1 drop their prescalers
+// by as much, so the refresh rate and the 50ms input cycle carry on unchanged;
+// timer2 runs from the crystal. Builds from 4MHz up (timer0 at /256, with no /32
+// to go to) keep to F_CPU.
+#if F_CPU <= 2000000UL
+#define SYSCLK_SLOW 8
+#endif
+// nonzero to slow down, zero for F_CPU; returns whether it was slow
+uint8_t sysclk_slow(uint8_t slow);
+// nonzero while it is
+extern uint8_t sysclk_slowed;
 
-#define SHUTTER_HALFPRESS_OFF()  PORTC &= ~(1 << PC5)
-#define SHUTTER_HALFPRESS_ON()   PORTC |= (1 << PC5)
-
-#define DIGIT_VALUE(x) PORTD = x
-
-#define BUTTON_STATE() ((PINC & 0b11100) >> 2)
+void io_init();
 
-// note: in contravention of my comment above, input.c uses an explicit pin-change interrupt vector :P
+// for portability, please keep all explicit port references in the board header
+// (see board.h)
+#include "board.h"
 
 // one-bit printf debugging...
 void blip();
@@ -44,5 +32,6 @@ void power_init();
 // let the user know we're turning off
 void acknowledge_power_off();
 
-// to save power if the device is left idle too long
+// to save power if the device is left idle too long; returns on a two-button
+// wake, or with rtc_alarm set when a scheduled start is due
 void power_down();
@@ -0,0 +1,161 @@
+#include <avr/eeprom.h>
+#include "log.h"
+#include "settings.h"
+#include "sensors.h"
+
+#define LOG_BLOCK   8
+#define LOG_PAYLOAD (LOG_BLOCK - 1)
+#define LOG_BLOCKS  ((E2END + 1 - SETTINGS_EEPROM_SIZE) / LOG_BLOCK)
+#define BLOCK(i)    (SETTINGS_EEPROM_SIZE + (uint16_t)(i) * LOG_BLOCK)
+
+#define NEXT_SEQ(s) ((s) == 254 ? 0 : (s) + 1)
+
+static uint8_t head;        // block to write next
+static uint8_t seq;         // and its sequence number
+static uint8_t wrapped;     // the ring is full, so head is also the oldest block
+
+// records are batched here; two buffers, since one may still be on its way to
+// EEPROM while the next fills
+static uint8_t batch[2][LOG_BLOCK];
+static uint8_t cur;
+static uint8_t fill;        // bytes used in batch[cur], including the sequence number
+
+// sensor baseline that frame records are relative to
+static uint8_t last_vcc, last_temp;
+// and what a frame byte implies: the frame after last_index, exposed for session_ticks
+static uint16_t last_index, session_ticks;
+
+void log_init()
+{
+    uint8_t prev = eeprom_read_byte((uint8_t *)BLOCK(LOG_BLOCKS - 1));
+    head = 0;
+    seq = 0;
+    for (uint8_t i = 0; i < LOG_BLOCKS; ++i) {
+        uint8_t s = eeprom_read_byte((uint8_t *)BLOCK(i));
+        // the newest block is the one whose successor doesn't follow it
+        if (prev != LOG_PAD && s != NEXT_SEQ(prev)) {
+            head = i;
+            seq = NEXT_SEQ(prev);
+        }
+        prev = s;
+    }
+    wrapped = eeprom_read_byte((uint8_t *)BLOCK(head)) != LOG_PAD;
+}
+
+static void flush()
+{
+    if (fill == 0)
+        return;
+    while (fill < LOG_BLOCK)
+        batch[cur][fill++] = LOG_PAD;
+    ee_write_block(batch[cur], BLOCK(head), LOG_BLOCK);
+    cur ^= 1;
+    fill = 0;
+    seq = NEXT_SEQ(seq);
+    if (++head == LOG_BLOCKS) {
+        head = 0;
+        wrapped = 1;
+    }
+}
+
+static void put(const uint8_t *rec, uint8_t len)
+{
+    if (fill + len > LOG_BLOCK)
+        flush();
+    if (fill == 0)
+        batch[cur][fill++] = seq;
+    while (len--)
+        batch[cur][fill++] = *rec++;
+}
+
+// battery in 20mV units, and temperature offset to fit a byte
+static void sample(uint8_t *vcc, uint8_t *temp)
+{
+    *vcc = read_vcc() / 2;
+    uint16_t t = read_temp();
+    *temp = (t < 128) ? 0 : (t > 128 + 255) ? 255 : t - 128;
+}
+
+// times longer than a record holds
+static uint16_t clamp(uint32_t ticks)
+{
+    return ticks > 0xFFFF ? 0xFFFF : ticks;
+}
+
+void log_session_start(uint32_t time)
+{
+    uint16_t ticks = clamp(time);
+    uint8_t rec[5];
+    rec[0] = LOG_SESSION;
+    rec[1] = ticks & 0xFF;
+    rec[2] = ticks >> 8;
+    sample(&rec[3], &rec[4]);
+    last_vcc = rec[3];
+    last_temp = rec[4];
+    last_index = 0;
+    session_ticks = ticks;
+    put(rec, sizeof(rec));
+}
+
+void log_frame(uint16_t index, uint32_t time)
+{
+    uint16_t ticks = clamp(time);
+    if (index != last_index + 1 || ticks != session_ticks) {
+        uint8_t rec[5] = { LOG_FRAME, index & 0xFF, index >> 8, ticks & 0xFF, ticks >> 8 };
+        put(rec, sizeof(rec));
+    }
+    last_index = index;
+
+    uint8_t vcc, temp;
+    sample(&vcc, &temp);
+    int8_t dv = vcc - last_vcc;
+    int8_t dt = temp - last_temp;
+    if (dv < -8 || dv > 7 || dt < -4 || dt > 3) {
+        uint8_t rec[3] = { LOG_SENSORS, vcc, temp };
+        put(rec, sizeof(rec));
+        dv = 0;
+        dt = 0;
+    }
+    last_vcc = vcc;
+    last_temp = temp;
+
+    uint8_t rec = ((dv & 0xF) << 3) | (dt & 0x7);
+    put(&rec, 1);
+}
+
+void log_cancel(uint32_t time)
+{
+    uint16_t ticks = clamp(time);
+    ++last_index;
+    uint8_t rec[3] = { LOG_CANCEL, ticks & 0xFF, ticks >> 8 };
+    put(rec, sizeof(rec));
+}
+
+void log_session_end()
+{
+    flush();
+}
+
+uint16_t log_size()
+{
+    return (uint16_t)(wrapped ? LOG_BLOCKS : head) * LOG_PAYLOAD;
+}
+
+uint8_t log_read(uint16_t pos)
+{
+    if (pos >= log_size())
+        return LOG_PAD;
+    // don't read past a block that's still being written
+    settings_flush();
+    uint8_t block = pos / LOG_PAYLOAD;
+    block += wrapped ? head : 0;
+    if (block >= LOG_BLOCKS)
+        block -= LOG_BLOCKS;
+    return eeprom_read_byte((uint8_t *)(BLOCK(block) + 1 + pos % LOG_PAYLOAD));
+}
+
+void log_dump(uint8_t *dst, uint16_t pos, uint8_t n)
+{
+    while (n--)
+        *dst++ = log_read(pos++);
+}
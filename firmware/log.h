@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+// Session flight recorder: what each exposure sequence actually did, kept in
+// the EEPROM past the settings journal.
+//
+// The log is a ring of 8-byte blocks. Byte 0 of each is a sequence number
+// (0-254) that finds the newest block at boot; the other seven hold records,
+// padded with LOG_PAD. Records never span blocks, and are batched in RAM so
+// each block is written once. A record is one of:
+//
+//   0x00-0x7F       a frame completed. bits 6..3 = change in battery voltage
+//                   (signed, 20mV units), bits 2..0 = change in the raw
+//                   temperature reading (signed). Its index and exposure are
+//                   delta-encoded to nothing: the frame after the last one
+//                   logged, and exactly the session's exposure length
+//   LOG_FRAME i i t t   the next frame byte's index (from 1) and the ticks its
+//                   exposure actually ran, when they aren't the ones implied
+//   LOG_SESSION t t v c   a sequence started: exposure length in clock ticks
+//                   (LSB first), battery in 20mV units, temperature - 128
+//   LOG_SENSORS v c a new baseline, when the change won't fit in a frame byte
+//   LOG_CANCEL t t  the frame in progress was cut short after t clock ticks
+//
+// Times of 0xFFFF ticks (2h16m) or longer are logged as 0xFFFF.
+//
+// The sequencer times exposures to the tick (see sequence.h), so a frame is
+// one byte, and a 500-frame session fits the 640 bytes the log has on a 328P.
+
+#define LOG_SESSION 0xE0
+#define LOG_SENSORS 0xE1
+#define LOG_CANCEL  0xE2
+#define LOG_FRAME   0xE3
+#define LOG_PAD     0xFF
+
+// find where the log left off
+void log_init();
+
+void log_session_start(uint32_t ticks);
+// frame number index completed, its exposure having run for ticks; samples
+// the battery and temperature
+void log_frame(uint16_t index, uint32_t ticks);
+// the frame in progress was cancelled after `ticks`
+void log_cancel(uint32_t ticks);
+// write out whatever is batched
+void log_session_end();
+
+// record bytes held, oldest first, without the block headers
+uint16_t log_size();
+// one record byte, by position from the oldest
+uint8_t log_read(uint16_t pos);
+// copy n record bytes starting at pos
+void log_dump(uint8_t *dst, uint16_t pos, uint8_t n);
@@ -17,50 +17,77 @@
 #include "display.h"
 #include "settings.h"
 #include "sensors.h"
+#include "log.h"
+#include "remote.h"
+#include "stops.h"
+#include "sequence.h"
+#include "energy.h"
+#include "instrument.h"
 
-// 20 minutes (with 1200 I/O polling cycles per minute)
+// 20 minutes (with 1200 input cycles per minute)
 #define IDLE_TIMEOUT_CYCLES 20 * 1200
 
-const uint16_t stop_table[] PROGMEM = {0, 1, 2, 3, 4, 5, 6, 8, 10, 13, 15, 20, 25, 30, 35, 40, 45, 50, 60, 75, 90, 120, 150, 180, 210, 240, 300, 360, 480, 540, 600, 720, 900, 1200, 1500, 1800, 2100, 2400, 2700, 3000, 3300, 3600, 4500, 5400};
-const size_t STOP_TABLE_SIZE = sizeof(stop_table) / sizeof(stop_table[0]);
+// remote mode can't see a host come or go (its lines are the display's until
+// the USART takes them, and an unplugged RXD idles high like a quiet one), so
+// it gives up on a host that's said nothing for this long, outside a sequence (5 minutes)
+#define REMOTE_QUIET_CYCLES 5 * 1200
 
-void adjust_stop(uint8_t min_sec[2], int8_t *current_stop, int8_t encoder_diff)
+// while the display is blanked during a sequence, flash a decimal point
+// for one input cycle out of this many, so it's obvious we're still running
+#define HEARTBEAT_CYCLES 40
+
+// input cycles between temperature readings for the crystal compensation
+// while a sequence runs (a minute)
+#define COMPENSATE_CYCLES 1200
+
+void adjust_stop(uint8_t t[3], int8_t *current_stop, int8_t encoder_diff)
 {
-    uint16_t secs = (uint16_t)min_sec[0] * 60 + min_sec[1];
+    uint32_t ticks = time_ticks(t);
     if (*current_stop < 0) {
         // the value was manually edited and we're possibly between stops, so find the one to start from
-        uint8_t i = 0;
-        // find the first stop that's greater than or equal to the current time
-        while(i < STOP_TABLE_SIZE && pgm_read_word(&stop_table[i]) < secs)
-            ++i;
+        uint8_t i = stop_find(ticks > 0xFFFF ? 0xFFFF : ticks);
+        // past the end of the scale (set by hand), up has nowhere to go
+        if (i == stop_count() && encoder_diff > 0)
+            return;
         // if we're going up and are between stops, the stop we found is where we want to increment to
         // with our first tick
-        if (encoder_diff > 0 && pgm_read_word(&stop_table[i]) != secs)
+        if (encoder_diff > 0 && stop_ticks(i) != ticks)
             --i;
         *current_stop = i;
     }
-    *current_stop += encoder_diff;
-    if (*current_stop < 0)
-        *current_stop = 0;
-    else if (*current_stop >= STOP_TABLE_SIZE)
-        *current_stop = STOP_TABLE_SIZE - 1;
-    uint16_t new_time = pgm_read_word(&stop_table[*current_stop]);
-    min_sec[0] = new_time / 60;
-    min_sec[1] = new_time % 60;
+    // a fast spin's diff can carry the sum past an int8_t
+    int16_t stop = *current_stop + encoder_diff;
+    if (stop < 0)
+        stop = 0;
+    else if (stop >= stop_count())
+        stop = stop_count() - 1;
+    *current_stop = stop;
+    uint16_t new_time = stop_ticks(*current_stop);
+    uint16_t secs = new_time / CLOCK_TICKS_PER_SEC;
+    t[0] = secs / 60;
+    t[1] = secs % 60;
+    t[2] = new_time % CLOCK_TICKS_PER_SEC;
 }
 
-void increment_num(uint8_t *num, int8_t encoder_diff, uint8_t max)
+static void increment_num16(uint16_t *num, int8_t encoder_diff, uint16_t max)
 {
     // spinning the encoder will stop at the low limit (0) and high limit (max)
-    // (where max is 59 or 99)
-    *num += encoder_diff;
-    if (*num > 200)
-        *num = 0;   // underflow, probably
-    else if (*num > max)
-        *num = max;
+    int16_t n = *num + encoder_diff;
+    if (n < 0)
+        n = 0;
+    else if (n > max)
+        n = max;
+    *num = n;
 }
 
-static unsigned char EditNum(uint8_t *num, uint8_t buttons, int8_t encoder_diff, uint8_t max)
+void increment_num(uint8_t *num, int8_t encoder_diff, uint8_t max)
+{
+    uint16_t n = *num;
+    increment_num16(&n, encoder_diff, max);
+    *num = n;
+}
+
+static unsigned char EditNum16(uint16_t *num, uint8_t buttons, int8_t encoder_diff, uint16_t max)
 {
     if (buttons == 0 && encoder_diff == 0)
         return 0;
@@ -84,7 +111,7 @@ static unsigned char EditNum(uint8_t *num, uint8_t buttons, int8_t encoder_diff,
     // the encoder increments / decrements by 1, saturating
     // (button taps wrap back to 0)
     if (encoder_diff != 0) {
-        increment_num(num, encoder_diff, max);
+        increment_num16(num, encoder_diff, max);
     } else {
         if (*num > max)
             *num = 0;
@@ -94,6 +121,14 @@ static unsigned char EditNum(uint8_t *num, uint8_t buttons, int8_t encoder_diff,
     return (buttons & (BUTTON_SET | BUTTON_START));
 }
 
+static unsigned char EditNum(uint8_t *num, uint8_t buttons, int8_t encoder_diff, uint8_t max)
+{
+    uint16_t n = *num;
+    unsigned char done = EditNum16(&n, buttons, encoder_diff, max);
+    *num = n;
+    return done;
+}
+
 void adjust_brightness(int8_t encoder_diff)
 {
     int8_t diff = encoder_diff ? encoder_diff : 1;
@@ -109,56 +144,136 @@ void adjust_brightness(int8_t encoder_diff)
     display_set_brightness(bright);
 }
 
+const uint8_t ticks_to_hundredths[CLOCK_TICKS_PER_SEC] PROGMEM = { 0, 12, 25, 37, 50, 62, 75, 87 };
+
+// show minutes from 100 up as hours and minutes, e.g. 2H05 (up to 9H59)
+void display_hours(uint16_t mins, uint8_t blink_mask)
+{
+    if (mins > 599)
+        mins = 599;
+    DisplayNum(mins / 60, HIGH_POS, blink_mask, 0, 0);
+    frame[0] = frame[1];
+    frame[1] = LETTER_H;
+    frame[EXTRA_POS] = EMPTY;
+    DisplayNum(mins % 60, LOW_POS, blink_mask, 0, 0);
+}
+
+// show a running clock as minutes:seconds, or hours and minutes from 100 minutes.
+// dp: bit 0 = decimal point after the minutes, bit 1 = after the seconds
+void display_clock(uint32_t secs, uint8_t dp)
+{
+    if (secs >= 100 * 60) {
+        display_hours(secs / 60, 0);
+        if (dp & 1) frame[1] &= DECIMAL;
+        if (dp & 2) frame[3] &= DECIMAL;
+    } else {
+        uint16_t s = secs;
+        DisplayNum(s / 60, HIGH_POS, 0, 3, dp & 1);
+        DisplayNum(s % 60, LOW_POS, 0, 0, dp >> 1);
+    }
+}
+
+// show a time setting as minutes:seconds (with a decimal point instead of the colon for delays),
+// as seconds.hundredths if it's under a minute with a fractional part, or as hours and
+// minutes from 100 minutes up.
+// blink_field: 0 = none, 1 = minutes, 2 = seconds, 3 = fraction
+void display_time(uint8_t t[3], uint8_t is_delay, uint8_t blink_field)
+{
+    if (t[0] >= 100) {
+        display_hours(t[0], (blink_field == 1) ? 0x40 : 0);
+        if (is_delay)
+            frame[1] &= DECIMAL;
+    } else if (t[0] == 0 && ((blink_field == 0 && t[2]) || blink_field == 3)) {
+        DisplayNum(t[1], HIGH_POS, 0, 1, 1);
+        frame[EXTRA_POS] = EMPTY;
+        DisplayNum(pgm_read_byte(&ticks_to_hundredths[t[2]]), LOW_POS, blink_field ? 0x40 : 0, 0, 0);
+    } else {
+        DisplayNum(t[0], HIGH_POS, (blink_field == 1) ? 0x40 : 0, blink_field ? 0 : 3, is_delay);
+        frame[EXTRA_POS] = is_delay ? EMPTY : COLON;
+        DisplayNum(t[1], LOW_POS, (blink_field == 2) ? 0x40 : 0, 0, 0);
+    }
+}
+
+// a time of day as hh:mm, 24-hour. blink_field: 0 = none, 1 = hours, 2 = minutes
+void display_time_of_day(uint16_t mins, uint8_t blink_field)
+{
+    DisplayNum(mins / 60, HIGH_POS, (blink_field == 1) ? 0x40 : 0, 0, 0);
+    frame[EXTRA_POS] = COLON;
+    DisplayNum(mins % 60, LOW_POS, (blink_field == 2) ? 0x40 : 0, 0, 0);
+}
+
+// the scheduled start time, in minutes since midnight; kept while disarmed
+// so it comes back next time
+static uint16_t alarm_mins = 22 * 60;
+
 void display_signature_byte(uint8_t addr)
 {
     DisplayHex(addr, HIGH_POS);
     DisplayHex(boot_signature_byte_get(addr), LOW_POS);
-    display[EXTRA_POS] = COLON;
+    frame[EXTRA_POS] = COLON;
 }
 
 enum State {
     // main menu
     ST_TIME, ST_DELAY, ST_COUNT, ST_OPTS,
     // options menu
-    ST_MLU, ST_HPRESS, ST_BRIGHT, ST_ENCODER_DIR, ST_POWER_METER,
-    ST_TEMP_SENSOR, ST_SIGNATURE_ROW, ST_SAVED,
+    ST_MLU, ST_HPRESS, ST_BRIGHT, ST_DIM, ST_ENCODER_DIR, ST_SCALE, ST_POWER_METER,
+    ST_TEMP_SENSOR, ST_XTAL, ST_SIGNATURE_ROW,
+#ifdef INSTRUMENT
+    ST_INSTRUMENT,
+#endif
+    ST_LOG, ST_REMOTE, ST_CLOCK, ST_ALARM, ST_SAVED,
     // edit states
-    ST_TIME_SET_MINS, ST_TIME_SET_SECS,
-    ST_DELAY_SET_MINS, ST_DELAY_SET_SECS,
-    ST_COUNT_SET, ST_MLU_SET,
+    ST_TIME_SET_MINS, ST_TIME_SET_SECS, ST_TIME_SET_FRAC,
+    ST_DELAY_SET_MINS, ST_DELAY_SET_SECS, ST_DELAY_SET_FRAC,
+    ST_COUNT_SET, ST_MLU_SET, ST_DIM_SET, ST_TEMP_CAL, ST_HOUR_SET, ST_MINUTE_SET,
+    // the plan won't last on the battery left; Start again starts it anyway
+    ST_LOW_BATTERY,
     // run states
-    ST_RUN_PRIME, ST_HPRESS_COMPLETE, ST_RUN_MANUAL,
-    ST_MLU_PRIME, ST_MLU_WAIT, ST_HPRESS_WAIT,
-    ST_RUN_AUTO, ST_WAIT
+    // a sequence is running (see sequence.h)
+    ST_RUN
 };
 
 const uint8_t main_menu[] PROGMEM = { ST_TIME, ST_DELAY, ST_COUNT, ST_OPTS };
 const uint8_t MAIN_MENU_SIZE = sizeof(main_menu) / sizeof(main_menu[0]);
 
-const uint8_t opts_menu[] PROGMEM = { ST_MLU, ST_HPRESS, ST_BRIGHT, ST_ENCODER_DIR, ST_POWER_METER, ST_TEMP_SENSOR, ST_SIGNATURE_ROW };
+const uint8_t opts_menu[] PROGMEM = { ST_MLU, ST_HPRESS, ST_BRIGHT, ST_DIM, ST_ENCODER_DIR, ST_SCALE, ST_POWER_METER, ST_TEMP_SENSOR, ST_XTAL, ST_SIGNATURE_ROW,
+#ifdef INSTRUMENT
+                                       ST_INSTRUMENT,
+#endif
+                                       ST_LOG, ST_REMOTE, ST_CLOCK, ST_ALARM };
 const uint8_t OPTS_MENU_SIZE = sizeof(opts_menu) / sizeof(opts_menu[0]);
 
-void InitRun(enum State *state)
+// what a sequence is doing, for the remote
+uint8_t run_phase(enum State state, const struct sequence_status *st)
 {
-    gMin = stime[0];
-    gSec = stime[1];
+    return (state == ST_RUN) ? st->phase : PHASE_IDLE;
+}
 
-    if (gMin > 0 || gSec > 0)
-    {
-        // count down
-        gDirection = -1;
-        *state = ST_RUN_AUTO;
-    }
-    else
-    {
-        // count up
-        gDirection = 1;
-        *state = ST_RUN_MANUAL;
-    }
+// whole seconds left, rounded up, so a countdown reads 0:01 until it's done
+static uint32_t secs_left(uint32_t ticks)
+{
+    return (ticks + CLOCK_TICKS_PER_SEC - 1) / CLOCK_TICKS_PER_SEC;
+}
 
-    // open the shutter and start the clock
-    SHUTTER_ON();
-    clock_start();
+// apply a REMOTE_SET_CONFIG payload, if every field is in range
+uint8_t set_config(const uint8_t *c)
+{
+    uint16_t n = c[6] | (uint16_t)c[7] << 8;
+    if (c[0] > MAX_MINUTES || c[1] > 59 || c[2] >= CLOCK_TICKS_PER_SEC
+        || c[3] > MAX_MINUTES || c[4] > 59 || c[5] >= CLOCK_TICKS_PER_SEC
+        || n > MAX_COUNT || c[8] > 99 || c[9] > 2)
+        return 0;
+    stime[0] = c[0];
+    stime[1] = c[1];
+    stime[2] = c[2];
+    delay[0] = c[3];
+    delay[1] = c[4];
+    delay[2] = c[5];
+    count    = n;
+    mlu      = c[8];
+    hpress   = c[9];
+    return 1;
 }
 
 uint8_t init_opts_state(enum State state)
@@ -166,25 +281,19 @@ uint8_t init_opts_state(enum State state)
     switch(state)
     {
     case ST_POWER_METER:
-        turn_adc_on();
         init_power_meter();
         return 1;
     case ST_TEMP_SENSOR:
-        turn_adc_on();
         init_temp_sensor();
         return 1;
+    case ST_XTAL:
+        init_xtal_meter();
+        return 1;
     default:
         return 0;
     }
 }
 
-void exit_opts_state(enum State state)
-{
-    if (state == ST_POWER_METER || state == ST_TEMP_SENSOR) {
-        turn_adc_off();
-    }
-}
-
 void run()
 {
     // init the state machine
@@ -195,27 +304,62 @@ void run()
     int8_t stime_stop = -1;
     int8_t delay_stop = -1;
     uint16_t idle_cycles = 0;
+    uint16_t remote_quiet = 0;    // input cycles since the host last spoke
+    uint16_t touch_cycles = 0;
+    uint8_t heartbeat = 0;
     uint8_t sig = 0;
+#ifdef INSTRUMENT
+    uint8_t instr_item = 0;
+#endif
+    uint16_t log_pos = 0;
     uint8_t main_menu_idx = 0;
     uint8_t opts_menu_idx = 0;
-    uint8_t exp_count = 0;
+    uint16_t logged = 0;          // frames written to the session log
+    uint16_t compensate_cycles = 0;
+    int8_t cal_celsius = 0;
+    uint8_t show_trim = 0;
+    uint8_t battery_view = POWER_VCC;
+    uint16_t hm_mins = 0;         // the time of day being edited
+    uint8_t hm_alarm = 0;         // and whether it's the alarm's
+    struct sequence_status st;
+    uint8_t phase = PHASE_IDLE;
 
     for(;;)
     {
         uint8_t buttons;
         int8_t encoder_diff;
+        uint8_t attended = 1;       // a start from the buttons, not the remote or the alarm
         input_poll(&buttons, &encoder_diff);
+        sequence_status(&st);
 
-        if (state >= ST_RUN_PRIME || buttons || encoder_diff) {
+        if (state == ST_RUN || buttons || encoder_diff) {
             idle_cycles = 0;
-        } else if (++idle_cycles == IDLE_TIMEOUT_CYCLES) {
-            turn_adc_off();
+        } else if (input_cycle && ++idle_cycles == IDLE_TIMEOUT_CYCLES) {
             break;
         }
 
+        // display power governor
+        if (buttons || encoder_diff) {
+            // a touch while the display is dark just brings it back;
+            // it would be rude to act on a button the user couldn't see the effect of
+            if (dim && touch_cycles >= 40 * dim) {
+                buttons = 0;
+                encoder_diff = 0;
+            }
+            touch_cycles = 0;
+        } else if (input_cycle && touch_cycles < 0xffff) {
+            ++touch_cycles;
+        }
+
+        // a touch on the timer itself ends remote mode
+        if (remote_active && (buttons || encoder_diff)) {
+            remote_off();
+            buttons = 0;
+            encoder_diff = 0;
+        }
+
         // soft power-off
         if ((buttons & (BUTTON_START | BUTTON_HOLD)) == (BUTTON_START | BUTTON_HOLD)) {
-            turn_adc_off();
             break;
         }
 
@@ -229,6 +373,92 @@ void run()
             continue;
         }
 
+        // remote commands; these act through the same paths as the buttons
+        if (remote_active) {
+            uint8_t msg[REMOTE_MAX_LEN];
+            uint8_t len = remote_receive(msg);
+            if (!len) {
+                // a host watching a sequence only listens
+                if (state == ST_RUN)
+                    remote_quiet = 0;
+                else if (input_cycle && ++remote_quiet >= REMOTE_QUIET_CYCLES)
+                    // the host's gone; power the USART down
+                    remote_off();
+            } else {
+                uint8_t status = REMOTE_OK;
+                idle_cycles = 0;
+                remote_quiet = 0;
+                switch (msg[0]) {
+                case REMOTE_GET_STATE: {
+                    uint32_t t = st.left ? st.left : st.elapsed;
+                    uint8_t reply[9] = { run_phase(state, &st), t, t >> 8, t >> 16, t >> 24,
+                                         st.remaining, st.remaining >> 8, st.done, st.done >> 8 };
+                    remote_send(REMOTE_STATE, reply, sizeof(reply));
+                    break;
+                }
+                case REMOTE_SET_CONFIG:
+                    if (state == ST_RUN) {
+                        status = REMOTE_BUSY;
+                    } else if (len != 11 || !set_config(&msg[1])) {
+                        status = REMOTE_INVALID;
+                    } else {
+                        stime_stop = -1;
+                        delay_stop = -1;
+                    }
+                    break;
+                case REMOTE_START:
+                    if (state == ST_RUN) {
+                        status = REMOTE_BUSY;
+                    } else {
+                        state = ST_TIME;
+                        main_menu_idx = 0;
+                        buttons = BUTTON_START;
+                        attended = 0;
+                    }
+                    break;
+                case REMOTE_STOP:
+                    if (state == ST_RUN)
+                        buttons = BUTTON_START;
+                    break;
+                case REMOTE_GET_LOG: {
+                    if (len != 3) {
+                        status = REMOTE_INVALID;
+                        break;
+                    }
+                    uint16_t pos = msg[1] | msg[2] << 8;
+                    uint16_t size = log_size();
+                    uint8_t n = 0;
+                    if (pos < size)
+                        n = (size - pos < REMOTE_LOG_CHUNK) ? size - pos : REMOTE_LOG_CHUNK;
+                    uint8_t reply[4 + REMOTE_LOG_CHUNK] = { size, size >> 8, pos, pos >> 8 };
+                    log_dump(&reply[4], pos, n);
+                    remote_send(REMOTE_LOG, reply, 4 + n);
+                    break;
+                }
+                default:
+                    status = REMOTE_INVALID;
+                    break;
+                }
+                // the queries' replies stand in for an ACK, unless they're refused
+                if (msg[0] != REMOTE_GET_STATE && (msg[0] != REMOTE_GET_LOG || status != REMOTE_OK))
+                    remote_send(REMOTE_ACK, &status, 1);
+            }
+        }
+
+        // the scheduled start time has come: start as if from the main page
+        // (if the display is dark, or the remote's in charge, the sequence starts regardless)
+        if (rtc_alarm) {
+            rtc_alarm = 0;
+            if (state != ST_RUN) {
+                state = ST_TIME;
+                main_menu_idx = 0;
+                buttons = BUTTON_START;
+                attended = 0;
+                // the half-press only blinks the apostrophe over what's there
+                display_time(stime, 0, 0);
+            }
+        }
+
         // general navigation
         if (buttons & (BUTTON_SELECT | BUTTON_BACK)) {
             if (state <= ST_OPTS) {
@@ -253,7 +483,6 @@ void run()
                     else
                         --opts_menu_idx;
                 }
-                exit_opts_state(state);
                 state = pgm_read_byte(&opts_menu[opts_menu_idx]);
                 init_opts_state(state);
                 buttons = 0;
@@ -261,29 +490,40 @@ void run()
         }
 
         if (buttons & BUTTON_START) {
+            if (state == ST_LOW_BATTERY) {
+                // start anyway
+                state = prevstate;
+            } else if (state < ST_OPTS && attended && !energy_plan_fits(read_vcc())) {
+                prevstate = state;
+                state = ST_LOW_BATTERY;
+                buttons = 0;
+                CLOCK_BLINK_RESET();
+            }
             if (state < ST_OPTS) {
-                // start exposure sequence
+                // start exposure sequence; the first edge is timed from the crystal,
+                // which may still be starting if we've only just booted
+                clock_wait_for_xtal();
                 prevstate = state;
-                remaining = count;
-                exp_count = 0;
                 cmode = (state == ST_COUNT);
                 buttons = 0;
-                state = ST_RUN_PRIME;
+                state = ST_RUN;
+                logged = 0;
+                compensate_cycles = 0;
+                clock_compensate(temp_celsius(read_temp()));
+                log_session_start(time_ticks(stime));
+                sequence_start(time_ticks(stime), time_ticks(delay), count, mlu, hpress);
+                sequence_status(&st);
             } else if (state > ST_OPTS && state < ST_SAVED) {
                 // leave options submenu
-                exit_opts_state(state);
                 buttons = 0;
                 state = ST_OPTS;
             }
         }
 
-    newstate:
         switch(state)
         {
         case ST_TIME:
-            DisplayNum(stime[0], HIGH_POS, 0, 3, 0);
-            display[EXTRA_POS] = COLON;
-            DisplayNum(stime[1], LOW_POS, 0, 0, 0);
+            display_time(stime, 0, 0);
             if (buttons & BUTTON_SET) {
                 state = ST_TIME_SET_MINS;
             } else if (encoder_diff) {
@@ -291,9 +531,7 @@ void run()
             }
             break;
         case ST_DELAY:
-            DisplayNum(delay[0], HIGH_POS, 0, 3, 1);
-            display[EXTRA_POS] = EMPTY;
-            DisplayNum(delay[1], LOW_POS, 0, 0, 0);
+            display_time(delay, 1, 0);
             if (buttons & BUTTON_SET) {
                 state = ST_DELAY_SET_MINS;
             } else if (encoder_diff) {
@@ -305,15 +543,15 @@ void run()
             if (buttons & BUTTON_SET) {
                 state = ST_COUNT_SET;
             } else if (encoder_diff) {
-                increment_num(&count, encoder_diff, 99);
+                increment_num16(&count, encoder_diff, MAX_COUNT);
             }
             break;
         case ST_OPTS:
-            display[0] = LETTER_O;
-            display[1] = LETTER_P;
-            display[2] = LETTER_T;
-            display[3] = LETTER_S;
-            display[EXTRA_POS] = EMPTY;
+            frame[0] = LETTER_O;
+            frame[1] = LETTER_P;
+            frame[2] = LETTER_T;
+            frame[3] = LETTER_S;
+            frame[EXTRA_POS] = EMPTY;
             if (buttons & BUTTON_START) {
                 state = pgm_read_byte(&opts_menu[opts_menu_idx]);
                 init_opts_state(state);
@@ -325,12 +563,17 @@ void run()
             }
             break;
         case ST_SAVED:
-            display[0] = LETTER_S;
-            display[1] = LETTER_A;
-            display[2] = LETTER_V;
-            display[3] = LETTER_E;
-            display[4] = EMPTY;
-            if (--remaining == 0)
+            if (settings_busy()) {
+                // still writing
+                display_spin();
+                break;
+            }
+            frame[0] = LETTER_S;
+            frame[1] = LETTER_A;
+            frame[2] = LETTER_V;
+            frame[3] = LETTER_E;
+            frame[4] = EMPTY;
+            if (input_cycle && --remaining == 0)
                 state = prevstate;
             break;
         // -- options submenu
@@ -343,22 +586,22 @@ void run()
             }
             break;
         case ST_HPRESS:
-            display[0] = LETTER_H & DECIMAL;
+            frame[0] = LETTER_H & DECIMAL;
             switch(hpress) {
             case 0:
-                display[1] = LETTER_O;
-                display[2] = LETTER_F;
-                display[3] = LETTER_F;
+                frame[1] = LETTER_O;
+                frame[2] = LETTER_F;
+                frame[3] = LETTER_F;
                 break;
             case 1:
-                display[1] = LETTER_1;
-                display[2] = LETTER_S;
-                display[3] = LETTER_T;
+                frame[1] = LETTER_1;
+                frame[2] = LETTER_S;
+                frame[3] = LETTER_T;
                 break;
             case 2:
-                display[1] = LETTER_A;
-                display[2] = LETTER_L;
-                display[3] = LETTER_L;
+                frame[1] = LETTER_A;
+                frame[2] = LETTER_L;
+                frame[3] = LETTER_L;
                 break;
             }
             if (buttons & BUTTON_SET) {
@@ -374,63 +617,237 @@ void run()
                 adjust_brightness(encoder_diff);
             }
             break;
+        case ST_DIM:
+            DisplayAlnum(LETTER_D, dim, 0, 0);
+            if (buttons & BUTTON_SET) {
+                state = ST_DIM_SET;
+            } else if (encoder_diff) {
+                increment_num(&dim, encoder_diff, 99);
+            }
+            break;
         case ST_ENCODER_DIR:
-            display[0] = LETTER_E;
-            display[1] = EMPTY;
-            display[2] = (enc_cw < 0) ? MINUS_SIGN : EMPTY;
-            display[3] = LETTER_1;
+            frame[0] = LETTER_E;
+            frame[1] = EMPTY;
+            frame[2] = (enc_cw < 0) ? MINUS_SIGN : EMPTY;
+            frame[3] = LETTER_1;
             if ((buttons & BUTTON_SET) || encoder_diff) {
                 enc_cw = -enc_cw;
             }
             break;
+        case ST_SCALE:
+            // S.Std, S.1-2, S.1-3 or S.L 5 (5 s steps)
+            frame[0] = LETTER_S & DECIMAL;
+            frame[EXTRA_POS] = EMPTY;
+            switch(scale) {
+            case STOP_SCALE_STD:
+                frame[1] = LETTER_S;
+                frame[2] = LETTER_T;
+                frame[3] = LETTER_D;
+                break;
+            case STOP_SCALE_HALF:
+            case STOP_SCALE_THIRD:
+                DisplayNum(scale + 1, LOW_POS, 0, 1, 0);
+                frame[1] = LETTER_1;
+                frame[2] = MINUS_SIGN;
+                break;
+            case STOP_SCALE_LINEAR:
+                DisplayNum(5, LOW_POS, 0, 1, 0);
+                frame[1] = LETTER_L;
+                break;
+            }
+            if ((buttons & BUTTON_SET) || encoder_diff) {
+                if (buttons & BUTTON_SET) {
+                    if (++scale == STOP_SCALES) scale = 0;
+                } else {
+                    increment_num(&scale, encoder_diff, STOP_SCALES - 1);
+                }
+                // the stop indexes belong to the old scale
+                stime_stop = -1;
+                delay_stop = -1;
+            }
+            break;
         case ST_POWER_METER:
-            display_power_meter();
+            // Set steps through the voltage, the charge used, and the hours left
+            if (buttons & BUTTON_SET) {
+                if (++battery_view > POWER_HOURS)
+                    battery_view = POWER_VCC;
+                init_power_meter();
+            }
+            display_power_meter(battery_view);
             break;
         case ST_TEMP_SENSOR:
             display_temp_sensor();
+            if (buttons & BUTTON_SET) {
+                // calibrate: say what the temperature really is
+                cal_celsius = temp_celsius(read_temp());
+                if (cal_celsius == TEMP_UNKNOWN)
+                    cal_celsius = 20;
+                state = ST_TEMP_CAL;
+            }
+            break;
+        case ST_XTAL:
+            // the knob trims the crystal; Set shows the trim alone
+            if (encoder_diff) {
+                int16_t trim = xtal_trim + encoder_diff;
+                xtal_trim = (trim < -XTAL_TRIM_MAX) ? -XTAL_TRIM_MAX : (trim > XTAL_TRIM_MAX) ? XTAL_TRIM_MAX : trim;
+                init_xtal_meter();
+            }
+            if (buttons & BUTTON_SET)
+                show_trim ^= 1;
+            display_xtal_meter(show_trim);
             break;
         case ST_SIGNATURE_ROW:
             sig = (sig + encoder_diff) & 0x1f;
             display_signature_byte(sig);
             break;
+#ifdef INSTRUMENT
+        case ST_INSTRUMENT:
+            // the knob steps through the readings (see instrument.h); Set starts the
+            // worst cases over
+            instr_item = (instr_item + INSTR_ITEMS + encoder_diff % INSTR_ITEMS) % INSTR_ITEMS;
+            if (buttons & BUTTON_SET)
+                instr_reset();
+            display_instrument(instr_item);
+            break;
+#endif
+        case ST_LOG:
+            // browse the session log a byte at a time; the decimal points
+            // carry the position's high bits
+            if (encoder_diff < 0 && log_pos < (uint8_t)-encoder_diff)
+                log_pos = 0;
+            else
+                log_pos += encoder_diff;
+            if (log_size() == 0)
+                log_pos = 0;
+            else if (log_pos >= log_size())
+                log_pos = log_size() - 1;
+            DisplayHex(log_pos & 0xFF, HIGH_POS);
+            DisplayHex(log_read(log_pos), LOW_POS);
+            if (log_pos & 0x100) frame[0] &= DECIMAL;
+            if (log_pos & 0x200) frame[1] &= DECIMAL;
+            frame[EXTRA_POS] = COLON;
+            break;
+        case ST_REMOTE:
+            frame[0] = LETTER_S;
+            frame[1] = LETTER_E;
+            frame[2] = LETTER_R;
+            frame[3] = EMPTY;
+            frame[EXTRA_POS] = EMPTY;
+            if (buttons & BUTTON_SET) {
+                // the display goes dark until a button brings it back, or
+                // the host goes quiet
+                remote_on();
+                remote_quiet = 0;
+            }
+            break;
+        case ST_CLOCK: {
+            // the colon ticks with the seconds; the knob sets the minute, Set the
+            // hours and minutes
+            uint32_t now = rtc_now();
+            display_time_of_day(now / 60, 0);
+            if (now & 1)
+                frame[EXTRA_POS] = EMPTY;
+            if (buttons & BUTTON_SET) {
+                hm_mins = now / 60;
+                hm_alarm = 0;
+                state = ST_HOUR_SET;
+            } else if (encoder_diff) {
+                rtc_set((uint32_t)((now / 60 + 24 * 60 + encoder_diff) % (24 * 60)) * 60);
+            }
+            break;
+        }
+        case ST_ALARM:
+            // the scheduled start: "A.OFF", or the time with the apostrophe once armed.
+            // Set sets it (and arms it), the knob arms and disarms it
+            if (rtc_armed() == RTC_OFF) {
+                frame[0] = LETTER_A & DECIMAL;
+                frame[1] = LETTER_O;
+                frame[2] = LETTER_F;
+                frame[3] = LETTER_F;
+                frame[EXTRA_POS] = EMPTY;
+            } else {
+                display_time_of_day(alarm_mins, 0);
+                frame[EXTRA_POS] &= APOS;
+            }
+            if (buttons & BUTTON_SET) {
+                hm_mins = alarm_mins;
+                hm_alarm = 1;
+                state = ST_HOUR_SET;
+            } else if (encoder_diff) {
+                rtc_arm(rtc_armed() == RTC_OFF ? alarm_mins * 60UL : RTC_OFF);
+            }
+            break;
         // -- end options submenu
         case ST_TIME_SET_MINS:
-            DisplayNum(stime[0], HIGH_POS, 0x40, 0, 0);
-            display[EXTRA_POS] = COLON;
-            DisplayNum(stime[1], LOW_POS, 0, 0, 0);
-            if (EditNum(&stime[0], buttons, encoder_diff, 99)) {
-                state = ST_TIME_SET_SECS;
+            display_time(stime, 0, 1);
+            if (EditNum(&stime[0], buttons, encoder_diff, MAX_MINUTES)) {
+                if (stime[0] >= 100) {
+                    // set to the minute from here up
+                    stime[1] = 0;
+                    stime[2] = 0;
+                    stime_stop = -1;
+                    state = ST_TIME;
+                } else {
+                    state = ST_TIME_SET_SECS;
+                }
             }
             break;
         case ST_TIME_SET_SECS:
-            DisplayNum(stime[0], HIGH_POS, 0, 0, 0);
-            display[EXTRA_POS] = COLON;
-            DisplayNum(stime[1], LOW_POS, 0x40, 0, 0);
+            display_time(stime, 0, 2);
             if (EditNum(&stime[1], buttons, encoder_diff, 59)) {
+                // fractions of a second are only worth setting on short exposures
+                if (stime[0] == 0) {
+                    state = ST_TIME_SET_FRAC;
+                } else {
+                    stime[2] = 0;
+                    stime_stop = -1;
+                    state = ST_TIME;
+                }
+            }
+            break;
+        case ST_TIME_SET_FRAC:
+            display_time(stime, 0, 3);
+            if (EditNum(&stime[2], buttons, encoder_diff, CLOCK_TICKS_PER_SEC - 1)) {
                 stime_stop = -1;
                 state = ST_TIME;
             }
             break;
         case ST_DELAY_SET_MINS:
-            DisplayNum(delay[0], HIGH_POS, 0x40, 0, 1);
-            display[EXTRA_POS] = EMPTY;
-            DisplayNum(delay[1], LOW_POS, 0, 0, 0);
-            if (EditNum(&delay[0], buttons, encoder_diff, 99)) {
-                state = ST_DELAY_SET_SECS;
+            display_time(delay, 1, 1);
+            if (EditNum(&delay[0], buttons, encoder_diff, MAX_MINUTES)) {
+                if (delay[0] >= 100) {
+                    // set to the minute from here up
+                    delay[1] = 0;
+                    delay[2] = 0;
+                    delay_stop = -1;
+                    state = ST_DELAY;
+                } else {
+                    state = ST_DELAY_SET_SECS;
+                }
             }
             break;
         case ST_DELAY_SET_SECS:
-            DisplayNum(delay[0], HIGH_POS, 0, 0, 1);
-            display[EXTRA_POS] = EMPTY;
-            DisplayNum(delay[1], LOW_POS, 0x40, 0, 0);
+            display_time(delay, 1, 2);
             if (EditNum(&delay[1], buttons, encoder_diff, 59)) {
+                if (delay[0] == 0) {
+                    state = ST_DELAY_SET_FRAC;
+                } else {
+                    delay[2] = 0;
+                    delay_stop = -1;
+                    state = ST_DELAY;
+                }
+            }
+            break;
+        case ST_DELAY_SET_FRAC:
+            display_time(delay, 1, 3);
+            if (EditNum(&delay[2], buttons, encoder_diff, CLOCK_TICKS_PER_SEC - 1)) {
                 delay_stop = -1;
                 state = ST_DELAY;
             }
             break;
         case ST_COUNT_SET:
             DisplayAlnum(LETTER_C, count, 0x40, 0);
-            if (EditNum(&count, buttons, encoder_diff, 99)) {
+            if (EditNum16(&count, buttons, encoder_diff, MAX_COUNT)) {
                 state = ST_COUNT;
             }
             break;
@@ -440,131 +857,134 @@ void run()
                 state = ST_MLU;
             }
             break;
-        case ST_RUN_PRIME:
-            if (hpress > 1 || (hpress == 1 && remaining == count)) {
-                SHUTTER_HALFPRESS_ON();
-                gMin = 0;
-                gSec = 1;
-                gDirection = -1;
-                clock_start();
-                state = ST_HPRESS_WAIT;
-                break;
+        case ST_DIM_SET:
+            DisplayAlnum(LETTER_D, dim, 0x40, 0);
+            if (EditNum(&dim, buttons, encoder_diff, 99)) {
+                state = ST_DIM;
             }
-            // fall through
-        case ST_HPRESS_COMPLETE:
-            if (mlu > 0) {
-                state = ST_MLU_PRIME;
-                SHUTTER_ON();
-                DisplayAlnum(LETTER_L, mlu, 0, 0);
+            break;
+        case ST_HOUR_SET:
+        case ST_MINUTE_SET: {
+            uint8_t h = hm_mins / 60;
+            uint8_t m = hm_mins % 60;
+            uint8_t done = (state == ST_HOUR_SET) ? EditNum(&h, buttons, encoder_diff, 23)
+                                                  : EditNum(&m, buttons, encoder_diff, 59);
+            hm_mins = h * 60 + m;
+            display_time_of_day(hm_mins, (state == ST_HOUR_SET) ? 1 : 2);
+            if (!done)
+                break;
+            if (state == ST_HOUR_SET) {
+                state = ST_MINUTE_SET;
+            } else if (hm_alarm) {
+                alarm_mins = hm_mins;
+                rtc_arm(alarm_mins * 60UL);
+                state = ST_ALARM;
             } else {
-                InitRun(&state);
-                goto newstate;
-            }
-            break;
-        case ST_RUN_AUTO:
-            if (gDirection == 0) {
-                // time has elapsed.  close the shutter and stop the timer.
-                SHUTTER_HALFPRESS_OFF();
-                SHUTTER_OFF();
-                clock_stop();
-
-                if (remaining > 0)
-                {
-                    if (--remaining == 0)
-                    {
-                        // we're done.
-                        state = prevstate;
-                        break;
-                    }
+                rtc_set(hm_mins * 60UL);
+                state = ST_CLOCK;
+            }
+            break;
+        }
+        case ST_LOW_BATTERY:
+            // "bAtt", blinking; any other button backs out
+            frame[0] = LETTER_B;
+            frame[1] = LETTER_A;
+            frame[2] = LETTER_T;
+            frame[3] = LETTER_T;
+            frame[EXTRA_POS] = EMPTY;
+            if (CLOCK_BLINKING())
+                frame[0] = frame[1] = frame[2] = frame[3] = EMPTY;
+            if (buttons || encoder_diff)
+                state = prevstate;
+            break;
+        case ST_TEMP_CAL:
+            Display3(cal_celsius, LETTER_C, 99, 1);
+            if (CLOCK_BLINKING())
+                frame[0] = frame[1] = frame[2] = EMPTY;
+            if (encoder_diff) {
+                CLOCK_BLINK_RESET();
+                int16_t t = cal_celsius + encoder_diff;
+                cal_celsius = (t < CAL_TEMP_MIN) ? CAL_TEMP_MIN : (t > CAL_TEMP_MAX) ? CAL_TEMP_MAX : t;
+            }
+            if (buttons & (BUTTON_SET | BUTTON_START)) {
+                temp_calibrate(read_temp(), cal_celsius);
+                init_temp_sensor();
+                state = ST_TEMP_SENSOR;
+            }
+            break;
+        case ST_RUN: {
+            // the shutter runs itself (see sequence.h); this just logs and draws it,
+            // and keeps the crystal compensation up with the temperature
+            // frames only ever finish one at a time between polls, but if we
+            // fell behind, the ones before the last ran as planned as far as we know
+            while (logged < st.done) {
+                ++logged;
+                log_frame(logged, logged == st.done ? st.exposed : time_ticks(stime));
+            }
+            if (input_cycle && ++compensate_cycles == COMPENSATE_CYCLES) {
+                compensate_cycles = 0;
+                clock_compensate(temp_celsius(read_temp()));
+            }
+            if (st.phase == PHASE_IDLE) {
+                // we're done.
+                log_session_end();
+                state = prevstate;
+                break;
+            }
+            // remaining exposures, or count done so far, if unlimited
+            uint16_t n = st.remaining ? st.remaining : st.done;
+            switch (st.phase) {
+            case PHASE_HALF_PRESS:
+                if (CLOCK_PHASE() & 0x40) {
+                    frame[EXTRA_POS] |= ~APOS;
+                } else {
+                    frame[EXTRA_POS] &= APOS;
                 }
-
-                ++exp_count;
-                gMin = delay[0];
-                gSec = delay[1];
-                gDirection = -1;
-                state = ST_WAIT;
-                clock_start();
-                goto newstate;
-            }
-            // fall through
-        case ST_RUN_MANUAL:
-            if (cmode == 0) {
-                // time left in this exposure
-                DisplayNum(gMin, HIGH_POS, 0, 3, 0);
-                DisplayNum(gSec, LOW_POS, 0, 0, 1);
-            } else {
-                // remaining exposures, or count done so far, if unlimited
-                DisplayAlnum(LETTER_C, remaining ? remaining : exp_count, 0, 1);
-            }
-            display[EXTRA_POS] = CLOCK_BLINKING() ? EMPTY : COLON;
-            break;
-        case ST_MLU_PRIME:
-            SHUTTER_HALFPRESS_OFF();
-            SHUTTER_OFF();
-            gMin = 0;
-            gSec = mlu;
-            gDirection = -1;
-            state = ST_MLU_WAIT;
-            clock_start();
-            // fall-through
-        case ST_MLU_WAIT:
-            DisplayAlnum(LETTER_L, gSec, 0, 0);
-            if (gDirection == 0)
-            {
-                // MLU wait period has elapsed
-                clock_stop();
-                InitRun(&state);
-                goto newstate;
-            }
-            break;
-        case ST_HPRESS_WAIT:
-            if (TCNT2 & 0x40) {
-                display[EXTRA_POS] |= ~APOS;
-            } else {
-                display[EXTRA_POS] &= APOS;
-            }
-            if (gDirection == 0) {
-                clock_stop();
-                state = ST_HPRESS_COMPLETE;
-                goto newstate;
-            }
-            break;
-        case ST_WAIT:
-            if (cmode == 0) {
-                // wait time
-                // except, if there are < 10 seconds to go, we will borrow
-                // the minutes field to display the remaining exposure count as well
-                if (gMin == 0 && gSec < 10) {
-                    DisplayNum(remaining ? remaining : exp_count, HIGH_POS, 0, 1, CLOCK_BLINKING() ? 0 : 1);
-                    DisplayNum(gSec, LOW_POS, 0, 1, 0);
+                break;
+            case PHASE_MIRROR_UP:
+                DisplayAlnum(LETTER_L, secs_left(st.left), 0, 0);
+                break;
+            case PHASE_EXPOSING:
+                if (cmode == 0) {
+                    // time left in this exposure, or so far, if it runs until stopped
+                    display_clock(st.left ? secs_left(st.left) : st.elapsed / CLOCK_TICKS_PER_SEC, 2);
                 } else {
-                    DisplayNum(gMin, HIGH_POS, 0, 3, CLOCK_BLINKING() ? 0 : 1);
-                    DisplayNum(gSec, LOW_POS, 0, 0, 0);
+                    DisplayAlnum(LETTER_C, n, 0, 1);
                 }
-            } else {
-                // remaining exposures
-                DisplayAlnum(LETTER_C, remaining ? remaining : exp_count, 0, CLOCK_BLINKING() ? 0 : 4);
-            }
-            display[EXTRA_POS] = EMPTY;
-            if (gDirection == 0)
-            {
-                // wait period has timed out;
-                // stop the timer and start a new cycle
-                clock_stop();
-                state = ST_RUN_PRIME;
-                goto newstate;
+                frame[EXTRA_POS] = CLOCK_BLINKING() ? EMPTY : COLON;
+                break;
+            case PHASE_WAITING:
+                if (cmode == 0) {
+                    // wait time
+                    // except, if there are < 10 seconds to go, we will borrow
+                    // the minutes field to display the remaining exposure count as well
+                    // (the last two digits of it, past 99)
+                    uint32_t secs = secs_left(st.left);
+                    if (secs < 10) {
+                        DisplayNum(n % 100, HIGH_POS, 0, n < 100 ? 1 : 0, CLOCK_BLINKING() ? 0 : 1);
+                        DisplayNum(secs, LOW_POS, 0, 1, 0);
+                    } else {
+                        display_clock(secs, CLOCK_BLINKING() ? 0 : 1);
+                    }
+                } else {
+                    DisplayAlnum(LETTER_C, n, 0, CLOCK_BLINKING() ? 0 : 4);
+                }
+                frame[EXTRA_POS] = EMPTY;
+                break;
             }
             break;
         }
+        }
 
-        if (state >= ST_RUN_PRIME) {
+        if (state == ST_RUN) {
             // check keys
             if (buttons & BUTTON_START) {
                 // canceled.
-                clock_stop();
-                SHUTTER_HALFPRESS_OFF();
-                SHUTTER_OFF();
-                display[EXTRA_POS] |= ~APOS;
+                sequence_stop(&st);
+                if (st.phase == PHASE_EXPOSING)
+                    log_cancel(st.elapsed);
+                log_session_end();
+                frame[EXTRA_POS] |= ~APOS;
 
                 state = cmode ? ST_COUNT : prevstate;
             } else if (buttons & BUTTON_SELECT) {
@@ -575,6 +995,35 @@ void run()
                 adjust_brightness(encoder_diff);
             }
         }
+
+        uint8_t new_phase = run_phase(state, &st);
+        if (remote_active && new_phase != phase) {
+            uint8_t event[5] = { new_phase, st.remaining, st.remaining >> 8, st.done, st.done >> 8 };
+            remote_send(REMOTE_EVENT, event, sizeof(event));
+        }
+        phase = new_phase;
+
+        // dim after `dim` seconds without a touch, and go dark after twice that.
+        // in remote mode the USART has two of the segment lines, so stay dark
+        uint8_t level = DISPLAY_ON;
+        if (dim && touch_cycles >= 20 * dim)
+            level = (touch_cycles >= 40 * dim) ? DISPLAY_OFF : DISPLAY_DIM;
+        if (remote_active)
+            level = DISPLAY_OFF;
+        if (input_cycle && ++heartbeat == HEARTBEAT_CYCLES)
+            heartbeat = 0;
+        if (level == DISPLAY_OFF && state == ST_RUN && heartbeat == 0 && !remote_active) {
+            frame[0] = frame[1] = frame[2] = EMPTY;
+            frame[3] = DECIMAL;
+            frame[EXTRA_POS] = EMPTY;
+            level = DISPLAY_DIM;
+        }
+
+        display_commit();
+        display_set_power(level);
+        // with nothing lit, run slow until there is. Not in remote mode: the
+        // USART's baud rate is set for F_CPU
+        sysclk_slow(level == DISPLAY_OFF && !remote_active);
     }
 }
 
@@ -586,6 +1035,7 @@ int main(void)
 
     // Load saved state, if any
     Load();
+    log_init();
 
     power_init();
     display_init();
@@ -598,6 +1048,16 @@ int main(void)
     {
         // doesn't return unless the device has been idle for a long time, ...
         run();
+        // back to F_CPU, for the delays in acknowledge_power_off()
+        sysclk_slow(0);
+        // (a soft power-off can interrupt a sequence; stop it, or the crystal
+        // would carry on running it while we sleep)
+        struct sequence_status st;
+        sequence_stop(&st);
+        if (st.phase == PHASE_EXPOSING)
+            log_cancel(st.elapsed);
+        log_session_end();
+        remote_off();
 
         // .. in which case we shut down, to save battery power.
         // but we leave a pin change interrupt running, so a button press will wake us up
@@ -0,0 +1,128 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/crc16.h>
+#include "remote.h"
+
+#define BAUD 9600
+// double speed mode: 2MHz / 8 / 26 = 9615 baud, 0.2% fast
+#define UBRR_VALUE ((F_CPU + 4UL * BAUD) / (8UL * BAUD) - 1)
+#define BAUD_ACTUAL (F_CPU / (8UL * (UBRR_VALUE + 1)))
+
+// beyond about 2% the host starts seeing framing errors
+_Static_assert(BAUD_ACTUAL * 50 > BAUD * 49 && BAUD_ACTUAL * 50 < BAUD * 51, "9600 baud is too far off at this F_CPU");
+
+uint8_t remote_active = 0;
+
+// receive: RX_vect assembles one message here; the main loop picks it up
+// before the next can start
+static volatile uint8_t rx_buf[REMOTE_MAX_LEN + 2];   // LEN, CMD, DATA, CRC
+static volatile uint8_t rx_pos = 0;                   // 0 = waiting for sync
+static volatile uint8_t rx_ready = 0;
+
+// transmit: a ring drained by UDRE_vect
+#define TX_SIZE 32
+static volatile uint8_t tx_buf[TX_SIZE];
+static volatile uint8_t tx_head = 0, tx_tail = 0;
+
+void remote_on()
+{
+    PRR &= ~(1 << PRUSART0);
+    UBRR0 = UBRR_VALUE;
+    UCSR0A = (1 << U2X0);
+    UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);   // 8N1
+    UCSR0B = (1 << RXCIE0) | (1 << RXEN0) | (1 << TXEN0);
+    rx_pos = 0;
+    rx_ready = 0;
+    tx_head = tx_tail = 0;
+    remote_active = 1;
+}
+
+void remote_off()
+{
+    if (!remote_active)
+        return;
+    // let the last reply drain, so the host isn't left with half a message
+    // (the transmitter itself finishes the byte in flight before turning off)
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    while (tx_head != tx_tail)
+        sleep_mode();
+    UCSR0B = 0;
+    PRR |= (1 << PRUSART0);
+    remote_active = 0;
+}
+
+ISR(USART_RX_vect)
+{
+    uint8_t b = UDR0;
+    if (rx_ready)
+        return;     // the last message hasn't been handled yet; drop this one
+    if (rx_pos == 0) {
+        if (b == REMOTE_SYNC)
+            rx_pos = 1;
+        return;
+    }
+    if (rx_pos == 1 && (b == 0 || b > REMOTE_MAX_LEN)) {
+        // not a length; maybe it's the start of the next message
+        rx_pos = (b == REMOTE_SYNC);
+        return;
+    }
+    rx_buf[rx_pos - 1] = b;
+    if (++rx_pos == rx_buf[0] + 3) {
+        rx_ready = 1;
+        rx_pos = 0;
+    }
+}
+
+ISR(USART_UDRE_vect)
+{
+    if (tx_head == tx_tail) {
+        UCSR0B &= ~(1 << UDRIE0);
+        return;
+    }
+    UDR0 = tx_buf[tx_tail];
+    tx_tail = (tx_tail + 1) % TX_SIZE;
+}
+
+uint8_t remote_receive(uint8_t *buf)
+{
+    if (!rx_ready)
+        return 0;
+    uint8_t len = rx_buf[0];
+    uint8_t crc = _crc8_ccitt_update(0, len);
+    for (uint8_t i = 0; i < len; ++i) {
+        buf[i] = rx_buf[i + 1];
+        crc = _crc8_ccitt_update(crc, buf[i]);
+    }
+    uint8_t ok = (crc == rx_buf[len + 1]);
+    rx_ready = 0;
+    return ok ? len : 0;
+}
+
+static void put(uint8_t b)
+{
+    uint8_t next = (tx_head + 1) % TX_SIZE;
+    // the ring only fills when sending faster than 9600 baud; wait for room
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    while (next == tx_tail)
+        sleep_mode();
+    tx_buf[tx_head] = b;
+    tx_head = next;
+}
+
+void remote_send(uint8_t cmd, const uint8_t *data, uint8_t len)
+{
+    if (!remote_active)
+        return;
+    uint8_t crc = _crc8_ccitt_update(0, len + 1);
+    crc = _crc8_ccitt_update(crc, cmd);
+    put(REMOTE_SYNC);
+    put(len + 1);
+    put(cmd);
+    for (uint8_t i = 0; i < len; ++i) {
+        put(data[i]);
+        crc = _crc8_ccitt_update(crc, data[i]);
+    }
+    put(crc);
+    UCSR0B |= (1 << UDRIE0);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+
+// resources used: USART0 (PD0/PD1, shared with two segment lines, so the
+// display is kept dark while remote mode is on)
+//
+// Remote control over a 9600 8N1 serial line. Every message, either way, is
+//   0x7E, LEN, CMD, DATA[LEN-1], CRC
+// where LEN counts CMD and DATA (1-16) and CRC is the CRC-8 (poly 0x07) of
+// LEN, CMD and DATA. Host to timer:
+//   REMOTE_GET_STATE                  -> REMOTE_STATE phase clock remaining done
+//       (clock in 1/8 s ticks, 32 bits; remaining and done 16 bits; all LSB first)
+//   REMOTE_SET_CONFIG m s t m s t count mlu hpress
+//                                     -> REMOTE_ACK status
+//       (exposure and delay as minutes (up to 240), seconds, 1/8 s ticks;
+//       count 16 bits, LSB first)
+//   REMOTE_START, REMOTE_STOP         -> REMOTE_ACK status
+//   REMOTE_GET_LOG pos                -> REMOTE_LOG size pos bytes
+//       (the session log's record bytes from pos, up to REMOTE_LOG_CHUNK of
+//       them, none past the end; size is how many the log holds; see log.h.
+//       pos and size 16 bits, LSB first)
+// and the timer sends REMOTE_EVENT phase remaining done whenever the phase changes.
+// status is 0 for success, or REMOTE_BUSY / REMOTE_INVALID.
+
+#define REMOTE_SYNC       0x7E
+#define REMOTE_MAX_LEN    16
+
+#define REMOTE_GET_STATE  0x10
+#define REMOTE_SET_CONFIG 0x11
+#define REMOTE_START      0x12
+#define REMOTE_STOP       0x13
+#define REMOTE_GET_LOG    0x14
+
+#define REMOTE_STATE      0x90
+#define REMOTE_ACK        0x91
+#define REMOTE_LOG        0x92
+#define REMOTE_EVENT      0xA0
+
+#define REMOTE_LOG_CHUNK  8
+
+#define REMOTE_OK         0
+#define REMOTE_BUSY       1
+#define REMOTE_INVALID    2
+
+// phase, in REMOTE_STATE and REMOTE_EVENT, is one of the PHASE_ values
+#include "sequence.h"
+
+// power the USART up or down; it's off (in PRR) unless a host is attached
+void remote_on();
+void remote_off();
+extern uint8_t remote_active;
+
+// copies a complete, checked message (CMD, DATA) to buf and returns its
+// length, or returns 0 if none has arrived
+uint8_t remote_receive(uint8_t *buf);
+
+// queue a message for sending; the USART sends it in the background
+void remote_send(uint8_t cmd, const uint8_t *data, uint8_t len);
@@ -1,11 +1,51 @@
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stdlib.h>
 #include "io.h"
 #include "display.h"
+#include "sensors.h"
+#include "settings.h"
+#include "clock.h"
+#include "energy.h"
+#include "input.h"
+
+// A reading is the sum of ADC_OVERSAMPLE conversions, taken back to back in
+// ADC noise reduction sleep so the CPU and I/O clocks are stopped while the ADC
+// samples. 16 samples buy two more bits, decimated to a 12-bit result.
+// The ADC is only powered for the length of a burst.
+#define ADC_OVERSAMPLE 16
+// input cycles between readings
+#define ADC_UPDATE_CYCLES 10
+
+// the ADC clock wants to be 50-200kHz; stay at 62.5kHz whatever F_CPU is
+#if F_CPU == 8000000UL
+#define ADC_PRESCALE_BITS ((1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0))  // 1/128
+#elif F_CPU == 4000000UL
+#define ADC_PRESCALE_BITS ((1 << ADPS2) | (1 << ADPS1))                 // 1/64
+#elif F_CPU == 2000000UL
+#define ADC_PRESCALE_BITS ((1 << ADPS2) | (1 << ADPS0))                 // 1/32
+#elif F_CPU == 1000000UL
+#define ADC_PRESCALE_BITS (1 << ADPS2)                                  // 1/16
+#else
+#error "no ADC prescaler for this F_CPU"
+#endif
+
+static volatile uint16_t adc_sum;
+static volatile uint8_t adc_count;
+static uint8_t adc_wait;
+
+ISR(ADC_vect)
+{
+    // the first conversion after enabling the ADC and switching references is junk
+    if (adc_count++)
+        adc_sum += ADCW;
+}
 
 void turn_adc_on()
 {
     PRR &= ~(1 << PRADC);
-    // enable ADC, 1/32 prescaler, 62.5kHz
-    ADCSRA |= (1 << ADEN) | (1 << ADPS2) | (1 << ADPS0);
+    // enable ADC, at 62.5kHz
+    ADCSRA |= (1 << ADEN) | ADC_PRESCALE_BITS;
 }
 
 void turn_adc_off()
@@ -14,47 +54,186 @@ void turn_adc_off()
     PRR |= (1 << PRADC);
 }
 
-void init_power_meter()
+// sum of ADC_OVERSAMPLE conversions on the channel in ADMUX
+static uint16_t adc_burst()
+{
+    // the ADC's prescaler is set for F_CPU
+    uint8_t slow = sysclk_slow(0);
+    turn_adc_on();
+    ADCSRA |= (1 << ADIE);
+    adc_sum = 0;
+    adc_count = 0;
+
+    // the refresh timer stops along with the I/O clock, so rather than let one
+    // digit glow for the length of the burst, skip a refresh
+    DIGITS_OFF();
+    set_sleep_mode(SLEEP_MODE_ADC);
+    while (adc_count <= ADC_OVERSAMPLE) {
+        // entering ADC noise reduction starts a conversion, unless one is
+        // already running (e.g. we were woken by another interrupt)
+        sleep_mode();
+    }
+
+    ADCSRA &= ~(1 << ADIE);
+    turn_adc_off();
+    energy_adc();
+    sysclk_slow(slow);
+    return adc_sum;
+}
+
+// a new reading is due every ADC_UPDATE_CYCLES input cycles
+static uint8_t adc_due()
+{
+    if (adc_wait) {
+        if (input_cycle)
+            --adc_wait;
+        return 0;
+    }
+    adc_wait = ADC_UPDATE_CYCLES - 1;
+    return 1;
+}
+
+// AVCC reference, 1.1V input
+#define MUX_VCC  ((1 << REFS0) | (1 << MUX3) | (1 << MUX2) | (1 << MUX1))
+// 1.1v reference, temperature sensor input
+#define MUX_TEMP ((1 << REFS1) | (1 << REFS0) | (1 << MUX3))
+
+uint16_t read_vcc()
+{
+    ADMUX = MUX_VCC;
+    // decimate to 12 bits: 0-4095
+    uint16_t sam = adc_burst() >> 2;
+    if (sam == 0)
+        return 0;
+    // VCC = 1.1V * 4096 / sam; we will retrieve hundredths here.
+    // 4096 * 110 doesn't fit in 16 bits, so divide an eighth of it
+    // and carry the remainder; two 16-bit divides beat one 32-bit one
+    uint16_t q = (512 * 110) / sam;
+    uint16_t r = (512 * 110) % sam;
+    return 8 * q + (8 * r) / sam;
+}
+
+uint16_t read_temp()
 {
-    // AVCC reference, 1.1V input
-    ADMUX = (1 << REFS0) | (1 << MUX3) | (1 << MUX2) | (1 << MUX1);
+    ADMUX = MUX_TEMP;
+    // rounded back to the ADC's 10-bit scale, but averaged
+    return (adc_burst() + ADC_OVERSAMPLE / 2) / ADC_OVERSAMPLE;
 }
 
-uint16_t sample_adc()
+// tenths: with the decimal point from -9.9 to 99.9, whole units beyond (-99 to 999)
+static void display_tenths(int16_t tenths, uint8_t letter)
 {
-    uint16_t sam = 0;
-    if (ADCSRA & (1 << ADIF)) {
-        sam = ADCW;
-        ADCSRA |= (1 << ADIF);
+    if (tenths > -100 && tenths < 1000) {
+        Display3(tenths, letter, 1, 0);
+        if (tenths >= 0 && tenths < 100)
+            frame[0] = EMPTY;
+    } else {
+        int16_t whole = tenths / 10;
+        Display3(whole < -99 ? -99 : whole > 999 ? 999 : whole, letter, 99, 0);
     }
-    ADCSRA |= (1 << ADSC);
-    return sam;
 }
 
-void display_power_meter()
+void init_power_meter()
+{
+    adc_wait = 0;
+}
+
+void display_power_meter(uint8_t view)
 {
-    uint16_t sam = sample_adc();
-    if (sam) {
-        // VCC = 1.1V * 1024 / adc; we will retrieve hundredths here
-        uint16_t cv = (1024L * 110) / sam;
-        // since the AVR's voltage range is 1.8 ... 5.5, I'm not going to worry about >= 10 V
-        Display3(cv, LETTER_v, 0, 0);
+    if (view == POWER_USED) {
+        uint32_t tenths = energy_used() / 100;
+        display_tenths(tenths > 9999 ? 9999 : tenths, LETTER_A);
+        return;
+    }
+    if (adc_due()) {
+        uint16_t cv = read_vcc();
+        if (view == POWER_HOURS) {
+            uint16_t tenths = energy_hours_left(cv);
+            display_tenths(tenths > 9999 ? 9999 : tenths, LETTER_H);
+            if (!cv)
+                frame[0] = frame[1] = frame[2] = MINUS_SIGN;
+        } else if (cv) {
+            // since the AVR's voltage range is 1.8 ... 5.5, I'm not going to worry about >= 10 V
+            Display3(cv, LETTER_v, 0, 0);
+        }
     }
 }
 
 void init_temp_sensor()
 {
-    // 1.1v reference, temperature sensor input
-    ADMUX = (1 << REFS1) | (1 << REFS0) | (1 << MUX3);
+    adc_wait = 0;
+}
+
+// the datasheet's typical slope, 1mV/C against a 1.1V reference: 0.93 LSB/C
+#define TEMP_LSB_PER_100C 93
+
+int8_t temp_celsius(uint16_t raw)
+{
+    uint8_t a = cal_raw[0] ? 0 : 1;
+    if (!cal_raw[a])
+        return TEMP_UNKNOWN;
+    int16_t t;
+    if (cal_raw[a ^ 1] && cal_raw[1] != cal_raw[0]) {
+        // straight line through both points, rounded
+        int32_t num = (int32_t)((int16_t)raw - (int16_t)cal_raw[0]) * (cal_temp[1] - cal_temp[0]);
+        int16_t den = (int16_t)cal_raw[1] - (int16_t)cal_raw[0];
+        if ((num < 0) != (den < 0))
+            num -= den / 2;
+        else
+            num += den / 2;
+        t = cal_temp[0] + num / den;
+    } else {
+        t = cal_temp[a] + ((int16_t)raw - (int16_t)cal_raw[a]) * 100 / TEMP_LSB_PER_100C;
+    }
+    return (t < CAL_TEMP_MIN) ? CAL_TEMP_MIN : (t > 125) ? 125 : t;
+}
+
+void temp_calibrate(uint16_t raw, int8_t celsius)
+{
+    uint8_t i;
+    if (!cal_raw[0])
+        i = 0;
+    else if (!cal_raw[1])
+        i = 1;
+    else
+        i = abs(celsius - cal_temp[0]) <= abs(celsius - cal_temp[1]) ? 0 : 1;
+    cal_raw[i] = raw;
+    cal_temp[i] = celsius;
 }
 
 void display_temp_sensor()
 {
-    // it turns out there *aren't* factory calibration values stored in the signature row
-    // so I will just display the raw sample for now, as the datasheet examples are way off
-    // I will need two readings at widely separated temperatures to compute the slope and y-intercept
-    uint16_t sam = sample_adc();
-    if (sam) {
-        Display3(sam, EMPTY, 99, 1);
+    // there *aren't* factory calibration values stored in the signature row, and
+    // the datasheet examples are way off, so until it's calibrated (see
+    // temp_calibrate()) this shows the raw sample
+    if (adc_due()) {
+        uint16_t raw = read_temp();
+        int8_t t = temp_celsius(raw);
+        if (t == TEMP_UNKNOWN) {
+            Display3(raw, EMPTY, 99, 1);
+        } else {
+            Display3(t, LETTER_C, 99, 1);
+            if (t >= 0 && t < 100)
+                frame[0] = EMPTY;
+        }
     }
 }
+
+void init_xtal_meter()
+{
+    adc_wait = 0;
+}
+
+void display_xtal_meter(uint8_t trim_only)
+{
+    if (adc_due())
+        clock_compensate(temp_celsius(read_temp()));
+    if (trim_only) {
+        // whole ppm, without leading zeroes
+        Display3(xtal_trim, LETTER_T, 99, 0);
+        frame[0] = (xtal_trim <= -10) ? MINUS_SIGN : EMPTY;
+        if (xtal_trim > -10 && xtal_trim < 10)
+            frame[1] = (xtal_trim < 0) ? MINUS_SIGN : EMPTY;
+    } else
+        display_tenths(clock_correction(), LETTER_P);
+}
@@ -1,10 +1,37 @@
 #pragma once
 
+#include <stdint.h>
+
 void turn_adc_on();
 void turn_adc_off();
 
+// battery voltage, in hundredths of a volt (0 if it couldn't be read)
+uint16_t read_vcc();
+// raw temperature sensor reading, 10 bits
+uint16_t read_temp();
+
+// a raw reading in degrees C, by the calibration in settings.h; with one point,
+// the sensor's typical slope stands in for the other. TEMP_UNKNOWN without any
+#define TEMP_UNKNOWN (-128)
+int8_t temp_celsius(uint16_t raw);
+// take raw as reading celsius: it replaces an empty point, or the one nearer
+// that temperature
+void temp_calibrate(uint16_t raw, int8_t celsius);
+
+// the battery: its voltage (n.nnv), the charge used since the batteries went in
+// (mAh, nn.nA) or the hours that's left should last at the average draw so far
+// (nn.nH); see energy.h
+#define POWER_VCC   0
+#define POWER_USED  1
+#define POWER_HOURS 2
 void init_power_meter();
-void display_power_meter();
+void display_power_meter(uint8_t view);
 
 void init_temp_sensor();
+// degrees C once calibrated, the raw reading until then
 void display_temp_sensor();
+
+// the crystal correction in force, in ppm (nn.nP), re-reading the temperature
+// as it goes; or with trim_only, just xtal_trim (nnt)
+void init_xtal_meter();
+void display_xtal_meter(uint8_t trim_only);
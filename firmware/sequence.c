@@ -0,0 +1,139 @@
+#include <avr/interrupt.h>
+#include "sequence.h"
+#include "clock.h"
+#include "io.h"
+
+volatile uint8_t sequence_changed = 0;
+volatile uint32_t sequence_due = 0;
+
+// the plan, fixed while the sequence runs
+static uint32_t exp_ticks, delay_ticks, mlu_ticks;
+static uint8_t hpress_mode;
+
+// where it's got to; written by the ISR once running
+static volatile uint8_t phase = PHASE_IDLE;
+static volatile uint8_t pulse;              // the mirror-up pulse is still on
+static volatile uint32_t phase_start, phase_end;
+static volatile uint16_t remaining, done;
+static volatile uint32_t exposed;
+
+static void enter(uint8_t p, uint32_t now, uint32_t len)
+{
+    phase = p;
+    phase_start = now;
+    phase_end = len ? now + len : 0;
+    sequence_due = phase_end;
+}
+
+static void begin_exposure(uint32_t now)
+{
+    SHUTTER_ON();
+    enter(PHASE_EXPOSING, now, exp_ticks);
+}
+
+static void begin_mirror(uint32_t now)
+{
+    if (!mlu_ticks) {
+        begin_exposure(now);
+        return;
+    }
+    SHUTTER_ON();
+    enter(PHASE_MIRROR_UP, now, mlu_ticks);
+    pulse = 1;
+    sequence_due = now + 1;
+}
+
+static void begin_frame(uint32_t now)
+{
+    if (hpress_mode > 1 || (hpress_mode == 1 && done == 0)) {
+        SHUTTER_HALFPRESS_ON();
+        enter(PHASE_HALF_PRESS, now, CLOCK_TICKS_PER_SEC);
+    } else {
+        begin_mirror(now);
+    }
+}
+
+static void end_exposure(uint32_t now)
+{
+    SHUTTER_HALFPRESS_OFF();
+    SHUTTER_OFF();
+    exposed = now - phase_start;
+    ++done;
+    if (remaining && --remaining == 0) {
+        enter(PHASE_IDLE, now, 0);
+        clock_stop();
+    } else {
+        enter(PHASE_WAITING, now, delay_ticks);
+    }
+}
+
+void sequence_edge(uint32_t now)
+{
+    switch (phase) {
+    case PHASE_HALF_PRESS:
+        begin_mirror(now);
+        break;
+    case PHASE_MIRROR_UP:
+        if (pulse) {
+            // mirror's up; the exposure starts mlu seconds after it went
+            pulse = 0;
+            SHUTTER_HALFPRESS_OFF();
+            SHUTTER_OFF();
+            sequence_due = phase_end;
+        } else {
+            begin_exposure(now);
+        }
+        break;
+    case PHASE_EXPOSING:
+        end_exposure(now);
+        break;
+    case PHASE_WAITING:
+        begin_frame(now);
+        break;
+    }
+    sequence_changed = 1;
+}
+
+void sequence_start(uint32_t exposure, uint32_t delay, uint16_t count, uint8_t mlu, uint8_t hpress)
+{
+    exp_ticks = exposure;
+    delay_ticks = delay ? delay : 1;
+    mlu_ticks = (uint32_t)mlu * CLOCK_TICKS_PER_SEC;
+    hpress_mode = hpress;
+    remaining = count;
+    done = 0;
+    exposed = 0;
+    pulse = 0;
+
+    // tick 0 is now: the first edge goes out straight away, and the clock
+    // counts the rest from here
+    begin_frame(0);
+    clock_start();
+}
+
+static void snapshot(struct sequence_status *s, uint32_t now)
+{
+    s->phase = phase;
+    s->elapsed = now - phase_start;
+    s->left = phase_end ? phase_end - now : 0;
+    s->remaining = remaining;
+    s->done = done;
+    s->exposed = exposed;
+}
+
+void sequence_status(struct sequence_status *s)
+{
+    cli();
+    snapshot(s, clock_ticks());
+    sei();
+}
+
+void sequence_stop(struct sequence_status *s)
+{
+    // with the interrupt off, nothing else changes it
+    clock_stop();
+    snapshot(s, clock_ticks());
+    SHUTTER_HALFPRESS_OFF();
+    SHUTTER_OFF();
+    enter(PHASE_IDLE, 0, 0);
+}
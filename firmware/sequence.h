@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+
+// resources used: the clock (timer2), and the shutter and half-press lines
+//
+// An exposure sequence runs from the clock's compare interrupt. Every shutter
+// and half-press edge falls due at a tick counted from the start of the
+// sequence, and each phase ends a fixed number of ticks after the one before,
+// so the edges land on the crystal tick however late the main loop is, and
+// nothing accumulates over hundreds of frames. The main loop only reads the
+// status back to draw it.
+//
+// A frame is: a second of half-press (if hpress says so), a one-tick mirror-up
+// pulse and mlu seconds' wait (if mlu is set), then the exposure; then the delay,
+// if another frame follows. The delay is at least one tick, so back-to-back
+// frames still show the camera two edges.
+
+// sequence phases, also as reported in REMOTE_STATE and REMOTE_EVENT
+#define PHASE_IDLE        0
+#define PHASE_HALF_PRESS  1
+#define PHASE_MIRROR_UP   2
+#define PHASE_EXPOSING    3
+#define PHASE_WAITING     4
+
+struct sequence_status {
+    uint8_t phase;
+    uint32_t elapsed;   // ticks into the phase
+    uint32_t left;      // ticks to the end of it; 0 if open-ended (an exposure of 0 runs until stopped)
+    uint16_t remaining; // frames to go, counting this one; 0 if unbounded
+    uint16_t done;      // frames completed
+    uint32_t exposed;   // ticks the last completed frame's exposure actually ran
+};
+
+// exposure and delay in clock ticks, count 0 = until stopped, mlu in seconds,
+// hpress 0 = never, 1 = first frame, 2 = every frame
+void sequence_start(uint32_t exposure, uint32_t delay, uint16_t count, uint8_t mlu, uint8_t hpress);
+// cancel: both lines go off, and s gets the status just before
+void sequence_stop(struct sequence_status *s);
+// a consistent snapshot, taken with interrupts off
+void sequence_status(struct sequence_status *s);
+
+// set at every edge, so the main loop can redraw without waiting for the next poll
+extern volatile uint8_t sequence_changed;
+
+// for the clock ISR: the tick the next edge is due at (0 = none), and the
+// handler to call then
+extern volatile uint32_t sequence_due;
+void sequence_edge(uint32_t now);
@@ -1,50 +1,257 @@
+#include <stddef.h>
+#include <string.h>
 #include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/crc16.h>
 #include "settings.h"
+#include "clock.h"
+#include "stops.h"
 
-uint8_t stime[2] = { 0, 0 };
-uint8_t delay[2] = { 0, 0 };
-uint8_t count    = 1;
+uint8_t stime[3] = { 0, 0, 0 };
+uint8_t delay[3] = { 0, 0, 0 };
+uint16_t count   = 1;
 uint8_t mlu      = 0;
 uint8_t bright   = 2;
 uint8_t hpress   = 1;
 int8_t  enc_cw   = 1;
+uint8_t dim      = 30;
+uint16_t cal_raw[2];
+int8_t  cal_temp[2];
+int8_t  xtal_trim = 0;
 
-inline void savebyte(uint16_t addr, uint8_t value)
+// Settings are saved as a whole record, into the slot after the newest one,
+// round-robin across their part of the EEPROM. That spreads the wear over every slot,
+// and if the battery sags halfway through a save, the torn record fails its CRC
+// and the previous one is still there to load. A new field goes at the end,
+// with a new version; Load() carries the old record's fields over.
+#define SETTINGS_VERSION 1
+
+struct record {
+    uint16_t seq;       // save counter; the newest valid record wins
+    uint8_t version;
+    uint8_t stime[3];
+    uint8_t delay[3];
+    uint8_t count[2];   // LSB first
+    uint8_t mlu;
+    uint8_t bright;
+    uint8_t hpress;
+    uint8_t enc_cw;
+    uint8_t dim;
+    uint8_t scale;
+    uint8_t cal_raw[2][2];  // LSB first
+    uint8_t cal_temp[2];
+    uint8_t xtal_trim;
+    uint8_t crc;        // CRC-8 of everything above
+} __attribute__((packed));
+
+// the CRC is the last byte, on any compiler, so a record's layout in the EEPROM
+// doesn't depend on padding
+_Static_assert(offsetof(struct record, crc) == sizeof(struct record) - 1, "struct record is padded");
+
+#define SLOT_COUNT (SETTINGS_EEPROM_SIZE / sizeof(struct record))
+#define SLOT(i) ((struct record *)((i) * sizeof(struct record)))
+
+// where the next save goes, and what the newest record holds
+static uint8_t next_slot = 0;
+static struct record last;
+
+// the write in progress: EE_READY_vect writes one byte each time the EEPROM
+// is ready for it, so saving never busy-waits
+static const uint8_t * volatile ee_src;
+static volatile uint16_t ee_addr;
+static volatile uint8_t ee_left = 0;
+
+ISR(EE_READY_vect)
+{
+    while (ee_left) {
+        uint8_t value = *ee_src++;
+        EEAR = ee_addr++;
+        --ee_left;
+        EECR |= (1 << EERE);
+        if (EEDR != value) {
+            EEDR = value;
+            // these two must be four cycles apart at most; we're in an ISR, so they are
+            EECR |= (1 << EEMPE);
+            EECR |= (1 << EEPE);
+            return;
+        }
+    }
+    // done; the interrupt is level-triggered, so turn it off
+    EECR &= ~(1 << EERIE);
+}
+
+uint8_t settings_busy()
+{
+    return EECR & (1 << EERIE);
+}
+
+void ee_write_block(const void *src, uint16_t addr, uint8_t len)
+{
+    settings_flush();
+    ee_src = src;
+    ee_addr = addr;
+    ee_left = len;
+    EECR |= (1 << EERIE);
+}
+
+void settings_flush()
+{
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    while (settings_busy())
+        sleep_mode();
+}
+
+// CRC-8 of a record of len bytes, but for its last byte (the CRC itself)
+static uint8_t record_crc(const void *r, uint8_t len)
+{
+    uint8_t crc = 0;
+    const uint8_t *p = r;
+    for (uint8_t i = 0; i < len - 1; ++i)
+        crc = _crc8_ccitt_update(crc, p[i]);
+    return crc;
+}
+
+uint32_t time_ticks(const uint8_t t[3])
 {
-    eeprom_update_byte((uint8_t *)addr, value);
+    return ((uint32_t)t[0] * 60 + t[1]) * CLOCK_TICKS_PER_SEC + t[2];
 }
 
-uint8_t loadbyte(uint16_t addr, uint8_t default_value, uint8_t max_value)
+static uint8_t validate(uint8_t value, uint8_t default_value, uint8_t max_value)
 {
-    uint8_t ret = eeprom_read_byte((uint8_t *) addr);
-    if (ret > max_value)
-        ret = default_value;
-    return ret;
+    return (value > max_value) ? default_value : value;
+}
+
+static uint8_t loadbyte(uint16_t addr, uint8_t default_value, uint8_t max_value)
+{
+    return validate(eeprom_read_byte((uint8_t *) addr), default_value, max_value);
 }
 
 void Save()
 {
-    savebyte(0, stime[0]);
-    savebyte(1, stime[1]);
-    savebyte(2, delay[0]);
-    savebyte(3, delay[1]);
-    savebyte(4, count);
-    savebyte(5, mlu);
-    savebyte(6, bright);
-    savebyte(7, hpress);
-    savebyte(8, enc_cw > 0 ? 1 : 0);
+    struct record r;
+
+    // the previous save's record may be the one being written
+    settings_flush();
+
+    r.version  = SETTINGS_VERSION;
+    r.seq      = last.seq + 1;
+    r.stime[0] = stime[0];
+    r.stime[1] = stime[1];
+    r.stime[2] = stime[2];
+    r.delay[0] = delay[0];
+    r.delay[1] = delay[1];
+    r.delay[2] = delay[2];
+    r.count[0] = count & 0xFF;
+    r.count[1] = count >> 8;
+    r.mlu      = mlu;
+    r.bright   = bright;
+    r.hpress   = hpress;
+    r.enc_cw   = enc_cw > 0 ? 1 : 0;
+    r.dim      = dim;
+    r.scale    = scale;
+    for (uint8_t i = 0; i < 2; ++i) {
+        r.cal_raw[i][0] = cal_raw[i] & 0xFF;
+        r.cal_raw[i][1] = cal_raw[i] >> 8;
+        r.cal_temp[i]   = cal_temp[i];
+    }
+    r.xtal_trim = xtal_trim;
+
+    // nothing changed since the last save; don't spend a slot on it
+    if (last.version == SETTINGS_VERSION
+        && memcmp(r.stime, last.stime, offsetof(struct record, crc) - offsetof(struct record, stime)) == 0)
+        return;
+
+    r.crc = record_crc(&r, sizeof(r));
+    last = r;
+    ee_write_block(&last, next_slot * sizeof(struct record), sizeof(last));
+    if (++next_slot == SLOT_COUNT)
+        next_slot = 0;
 }
 
-void Load()
+// settings from before the journal: the first nine fields, one byte each at
+// fixed addresses. Unless they're all in range this isn't a legacy record (a
+// fresh chip, or a journal whose records are all torn), and every field takes
+// its default. The fields they didn't have take theirs either way
+static const uint8_t legacy_max[9] = { 99, 59, 99, 59, 99, 99, 5, 2, 1 };
+
+static uint8_t legacy(uint8_t present, uint16_t addr, uint8_t default_value, uint8_t max_value)
+{
+    return present ? loadbyte(addr, default_value, max_value) : default_value;
+}
+
+static void load_legacy()
 {
-    stime[0] = loadbyte(0, 3, 99);
-    stime[1] = loadbyte(1, 0, 59);
-    delay[0] = loadbyte(2, 0, 99);
-    delay[1] = loadbyte(3, 5, 59);
-    count    = loadbyte(4, 10, 99);
-    mlu      = loadbyte(5, 0, 99);
-    bright   = loadbyte(6, 2, 5);
-    hpress   = loadbyte(7, 1, 2);
-    enc_cw   = (int8_t)loadbyte(8, 1, 1);
+    uint8_t present = 1;
+    for (uint8_t i = 0; i < sizeof(legacy_max); ++i)
+        if (eeprom_read_byte((uint8_t *)(uint16_t)i) > legacy_max[i])
+            present = 0;
+
+    stime[0] = legacy(present, 0, 3, 99);
+    stime[1] = legacy(present, 1, 0, 59);
+    delay[0] = legacy(present, 2, 0, 99);
+    delay[1] = legacy(present, 3, 5, 59);
+    count    = legacy(present, 4, 10, 99);
+    mlu      = legacy(present, 5, 0, 99);
+    bright   = legacy(present, 6, 2, 5);
+    hpress   = legacy(present, 7, 1, 2);
+    enc_cw   = (int8_t)legacy(present, 8, 1, 1);
     if (enc_cw == 0) --enc_cw;
 }
+
+void Load()
+{
+    // the whole journal in one read; it's only on the stack while we look
+    struct record slots[SLOT_COUNT];
+    uint8_t found = 0;
+
+    eeprom_read_block(slots, SLOT(0), sizeof(slots));
+    for (uint8_t i = 0; i < SLOT_COUNT; ++i) {
+        struct record *r = &slots[i];
+        if (r->version != SETTINGS_VERSION || r->crc != record_crc(r, sizeof(*r)))
+            continue;
+        // serial-number comparison, so the counter can wrap
+        if (!found || (int16_t)(r->seq - last.seq) > 0) {
+            last = *r;
+            next_slot = i + 1;
+            found = 1;
+        }
+    }
+    if (next_slot == SLOT_COUNT)
+        next_slot = 0;
+
+    if (!found) {
+        // a fresh chip, or one last saved by the firmware before the journal.
+        // The first save lands in slot 0, over the old bytes, once they've
+        // been carried over
+        last.version = 0;
+        last.seq = 0;
+        load_legacy();
+        return;
+    }
+
+    stime[0] = validate(last.stime[0], 3, MAX_MINUTES);
+    stime[1] = validate(last.stime[1], 0, 59);
+    stime[2] = validate(last.stime[2], 0, CLOCK_TICKS_PER_SEC - 1);
+    delay[0] = validate(last.delay[0], 0, MAX_MINUTES);
+    delay[1] = validate(last.delay[1], 5, 59);
+    delay[2] = validate(last.delay[2], 0, CLOCK_TICKS_PER_SEC - 1);
+    count    = last.count[0] | (uint16_t)last.count[1] << 8;
+    if (count > MAX_COUNT)
+        count = 10;
+    mlu      = validate(last.mlu, 0, 99);
+    bright   = validate(last.bright, 2, 5);
+    hpress   = validate(last.hpress, 1, 2);
+    enc_cw   = last.enc_cw ? 1 : -1;
+    dim      = validate(last.dim, 30, 99);
+    scale    = validate(last.scale, STOP_SCALE_STD, STOP_SCALES - 1);
+    for (uint8_t i = 0; i < 2; ++i) {
+        cal_raw[i]  = last.cal_raw[i][0] | (uint16_t)last.cal_raw[i][1] << 8;
+        cal_temp[i] = (int8_t)last.cal_temp[i];
+        if (cal_raw[i] > 1023 || cal_temp[i] < CAL_TEMP_MIN || cal_temp[i] > CAL_TEMP_MAX)
+            cal_raw[i] = 0;
+    }
+    xtal_trim = (int8_t)last.xtal_trim;
+    if (xtal_trim < -XTAL_TRIM_MAX || xtal_trim > XTAL_TRIM_MAX)
+        xtal_trim = 0;
+}
@@ -1,11 +1,48 @@
 #pragma once
 
-extern uint8_t stime[2];
-extern uint8_t delay[2];
-extern uint8_t count;
+#include <avr/io.h>
+
+// minutes, seconds, and clock ticks (1/8 s)
+extern uint8_t stime[3];
+extern uint8_t delay[3];
+// frames in a sequence; 0 = until cancelled
+extern uint16_t count;
 extern uint8_t mlu;
 extern uint8_t bright;
 extern uint8_t hpress;
 extern int8_t enc_cw;
+// the longest exposure or delay, in minutes. From 100 minutes up, times are
+// set (and shown) in hours and minutes
+#define MAX_MINUTES 240
+#define MAX_COUNT   999
+
+// a time setting in clock ticks
+uint32_t time_ticks(const uint8_t t[3]);
+
+// two-point calibration of the on-die temperature sensor: the raw readings
+// (0 = no point) at two known temperatures, in degrees C
+extern uint16_t cal_raw[2];
+extern int8_t cal_temp[2];
+#define CAL_TEMP_MIN  (-40)
+#define CAL_TEMP_MAX  85
+// the crystal's own error at 25C, in ppm; positive if it runs slow
+extern int8_t xtal_trim;
+#define XTAL_TRIM_MAX 99
+// seconds without input before the display dims (and blanks, after twice that); 0 = never
+extern uint8_t dim;
+// starts writing the settings in the background; see settings_busy()
 void Save();
 void Load();
+// nonzero while a save (or any other queued EEPROM write) is still being written
+uint8_t settings_busy();
+// sleep until the write in progress, if any, is done
+void settings_flush();
+
+// the settings journal keeps to the first 3/8 of the EEPROM (15 slots on a
+// 328P); the rest belongs to the session log, which needs its 5/8 to hold a
+// 500-frame session (see log.h)
+#define SETTINGS_EEPROM_SIZE ((E2END + 1) / 8 * 3)
+
+// queue a block to be written to EEPROM in the background, after any write
+// already in progress. src must stay put until settings_busy() goes quiet
+void ee_write_block(const void *src, uint16_t addr, uint8_t len);
@@ -0,0 +1,36 @@
+#include <avr/pgmspace.h>
+#include "stops.h"
+// generated into the build tree (see the Makefile); <> so a stray copy here can't shadow it
+#include <stop_tables.h>
+
+uint8_t scale = STOP_SCALE_STD;
+
+static const uint16_t *table()
+{
+    return pgm_read_ptr(&stop_tables[scale].ticks);
+}
+
+uint8_t stop_count()
+{
+    return pgm_read_byte(&stop_tables[scale].count);
+}
+
+uint16_t stop_ticks(uint8_t i)
+{
+    return pgm_read_word(&table()[i]);
+}
+
+uint8_t stop_find(uint16_t ticks)
+{
+    // binary search for the lower bound; the tables are sorted and unique
+    const uint16_t *t = table();
+    uint8_t lo = 0, hi = stop_count();
+    while (lo < hi) {
+        uint8_t mid = (lo + hi) / 2;
+        if (pgm_read_word(&t[mid]) < ticks)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+// The stop scales the knob steps exposure and delay times through, in clock
+// ticks. The tables are generated at build time by host/gen-stops.c.
+#define STOP_SCALE_STD    0     // the original hand-picked scale
+#define STOP_SCALE_HALF   1     // 1/2 stops, 1/8 s to 68.5 min
+#define STOP_SCALE_THIRD  2     // 1/3 stops, 1/8 s to 86 min
+#define STOP_SCALE_LINEAR 3     // every 5 s up to 10 min
+#define STOP_SCALES       4
+
+struct stop_table {
+    const uint16_t *ticks;
+    uint8_t count;
+};
+
+// the scale in use; saved with the settings
+extern uint8_t scale;
+
+uint8_t stop_count();
+uint16_t stop_ticks(uint8_t i);
+// the first stop that's at least ticks long, or stop_count() if there's none
+uint8_t stop_find(uint16_t ticks);